@@ -0,0 +1,34 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+// Minimal timing harness for the headless benchmarks started with --bench-* on the command line.
+// Runs fn a number of times and returns the fastest run in milliseconds, which filters out
+// interference from the rest of the system better than the average does.
+template <typename Function>
+double BenchmarkMilliseconds(Function fn, int iterations = 10)
+{
+    double best = 1e30;
+    for (int i = 0; i < iterations; ++i)
+    {
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        fn();
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+        if (elapsed.count() < best)
+            best = elapsed.count();
+    }
+    return best;
+}
+
+// prints one result line, with the speedup against a baseline when one is given
+inline void BenchmarkReport(const char* name, double milliseconds, double baseline = 0.0)
+{
+    std::cout << "  " << std::left << std::setw(36) << name << std::right << std::setw(10) << std::fixed << std::setprecision(3) << milliseconds << " ms";
+    if (baseline > 0.0)
+        std::cout << "  (" << std::setprecision(2) << baseline / milliseconds << "x)";
+    std::cout << std::endl;
+}
+#endif
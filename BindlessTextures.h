@@ -0,0 +1,120 @@
+#ifndef BINDLESS_TEXTURES_H
+#define BINDLESS_TEXTURES_H
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+// Binding point of the handle table, shaders declare it with
+//
+//  layout(std430, binding = 1) readonly buffer TextureHandles
+//  {
+//      uvec2 handles[];
+//  };
+//
+// and sample with texture(sampler2D(handles[index]), uv).
+const GLuint TEXTURE_HANDLES_BINDING = 1;
+
+// Makes textures resident through ARB_bindless_texture and keeps their 64 bit handles in a shader storage
+// buffer, so a draw only passes an index into the table instead of binding a texture. A texture must be
+// complete before Add and must not be respecified afterwards, handles freeze its state.
+class BindlessTextureTable
+{
+public:
+    GLuint Buffer;
+
+    BindlessTextureTable() : Buffer(0), capacity(0)
+    {
+    }
+
+    // Mesa's software drivers and older GPUs do not expose the extension, callers fall back to the atlas
+    static bool Supported()
+    {
+        return GLEW_ARB_bindless_texture && GLEW_ARB_shader_storage_buffer_object;
+    }
+
+    // Indexing the table with a value that differs between instances of one draw needs hardware that
+    // accepts non-uniform handles; without it every instanced draw must use a single texture
+    static bool NonUniformHandles()
+    {
+        return GLEW_NV_gpu_shader5 != 0;
+    }
+
+    void Create()
+    {
+        glGenBuffers(1, &Buffer);
+    }
+
+    // makes textureId resident and returns its index in the table
+    int Add(GLuint textureId)
+    {
+        std::unordered_map<GLuint, int>::const_iterator found = indices.find(textureId);
+        if (found != indices.end())
+            return found->second;
+
+        GLuint64 handle = glGetTextureHandleARB(textureId);
+        glMakeTextureHandleResidentARB(handle);
+
+        int index = (int)handles.size();
+        handles.push_back(handle);
+        indices[textureId] = index;
+
+        upload();
+        return index;
+    }
+
+    // index of textureId in the table, -1 when it has not been made resident
+    int Find(GLuint textureId) const
+    {
+        std::unordered_map<GLuint, int>::const_iterator found = indices.find(textureId);
+        return found == indices.end() ? -1 : found->second;
+    }
+
+    size_t Size() const
+    {
+        return handles.size();
+    }
+
+    void Bind() const
+    {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TEXTURE_HANDLES_BINDING, Buffer);
+    }
+
+    // must run before the textures are deleted
+    void Destroy()
+    {
+        for (size_t i = 0; i < handles.size(); ++i)
+            glMakeTextureHandleNonResidentARB(handles[i]);
+
+        glDeleteBuffers(1, &Buffer);
+        Buffer = 0;
+        capacity = 0;
+        handles.clear();
+        indices.clear();
+    }
+
+private:
+    std::vector<GLuint64> handles;
+    std::unordered_map<GLuint, int> indices;
+    size_t capacity;
+
+    // textures arrive a few per frame, so the buffer grows geometrically and only the new handle is written
+    void upload()
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, Buffer);
+        if (handles.size() > capacity)
+        {
+            capacity = std::max<size_t>(16, capacity * 2);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, capacity * sizeof(GLuint64), NULL, GL_DYNAMIC_DRAW);
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, handles.size() * sizeof(GLuint64), handles.data());
+        }
+        else
+        {
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, (handles.size() - 1) * sizeof(GLuint64), sizeof(GLuint64), &handles.back());
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+};
+#endif
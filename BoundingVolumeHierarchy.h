@@ -0,0 +1,664 @@
+#ifndef BOUNDING_VOLUME_HIERARCHY_H
+#define BOUNDING_VOLUME_HIERARCHY_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+// Axis aligned box of one primitive or node
+struct BvhBounds
+{
+    glm::vec3 Min;
+    glm::vec3 Max;
+};
+
+// Result of a ray cast, Primitive is BoundingVolumeHierarchy::NONE when nothing was hit
+struct BvhHit
+{
+    uint32_t Primitive;
+    float Distance;     // along the ray, in units of its direction's length
+};
+
+// 32 bytes, two to a cache line
+struct BvhNode
+{
+    glm::vec3 Min;
+    uint32_t First;     // left child of an interior node, the right one follows it; first primitive entry of a leaf
+    glm::vec3 Max;
+    uint32_t Count;     // primitives of a leaf, 0 for an interior node
+};
+
+// Binary tree of boxes over primitives the caller numbers 0 to n - 1, for frustum culling, ray casts and
+// overlap queries that skip whole groups of primitives at once.
+//
+// Build splits each node where the surface area heuristic puts it, evaluated over 16 bins of the centroids
+// along their longest axis. The top of the tree is built by several threads: a node's binning is split over
+// its share of them, and its two children are built by different threads until every thread has a subtree.
+// The primitive boxes are stored in leaf order, so a leaf's primitives are tested from consecutive memory.
+//
+// Moving primitives do not need a new tree. SetBounds records the new box and marks its leaf, Refit then
+// grows or shrinks the marked leaves and their ancestors until an ancestor's box does not change, or redoes
+// every node in one backwards pass when many leaves moved. Lots of motion makes the boxes overlap more, so a
+// tree whose primitives moved far should be built again.
+class BoundingVolumeHierarchy
+{
+public:
+    static const uint32_t NONE = 0xFFFFFFFF;
+    static const uint32_t MAX_LEAF_SIZE = 4;
+
+    // statistics
+    unsigned int Builds;
+    unsigned int Refits;
+    unsigned long long NodesVisited;    // by all queries
+
+    BoundingVolumeHierarchy() : Builds(0), Refits(0), NodesVisited(0), nodeCount(0)
+    {
+    }
+
+    // builds the tree over the boxes, with threadCount threads, 0 for every core
+    void Build(const std::vector<BvhBounds>& bounds, unsigned int threadCount = 0)
+    {
+        ++Builds;
+
+        uint32_t count = (uint32_t)bounds.size();
+        references.resize(count);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            references[i].Bounds = bounds[i];
+            references[i].Primitive = i;
+        }
+        leafOf.assign(count, (uint32_t)NONE);
+
+        nodes.resize(count > 0 ? 2 * count - 1 : 0);
+        parents.resize(nodes.size());
+        dirty.assign(nodes.size(), 0);
+        dirtyLeaves.clear();
+        primitives.resize(count);
+        indices.resize(count);
+        positions.resize(count);
+        if (count == 0)
+        {
+            nodeCount = 0;
+            return;
+        }
+
+        if (threadCount == 0)
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+        nodeCount = 1;
+        parents[0] = NONE;
+        buildNode(0, 0, count, 0, threadCount);
+
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            primitives[i] = references[i].Bounds;
+            indices[i] = references[i].Primitive;
+            positions[indices[i]] = i;
+        }
+        references.clear();
+        references.shrink_to_fit();
+    }
+
+    // Changes a primitive's box, returns false when it is the same. The tree is updated by the next Refit.
+    bool SetBounds(uint32_t primitive, const BvhBounds& bounds)
+    {
+        BvhBounds& current = primitives[positions[primitive]];
+        if (current.Min == bounds.Min && current.Max == bounds.Max)
+            return false;
+
+        current = bounds;
+        uint32_t leaf = leafOf[primitive];
+        if (!dirty[leaf])
+        {
+            dirty[leaf] = 1;
+            dirtyLeaves.push_back(leaf);
+        }
+        return true;
+    }
+
+    const BvhBounds& Bounds(uint32_t primitive) const
+    {
+        return primitives[positions[primitive]];
+    }
+
+    // Brings the node boxes up to date with the SetBounds calls since the last Refit or Build
+    void Refit()
+    {
+        if (dirtyLeaves.empty())
+            return;
+        ++Refits;
+
+        // children are always stored after their parent, so a backwards pass sees them first
+        if (dirtyLeaves.size() > nodeCount / 16)
+        {
+            for (uint32_t node = nodeCount; node-- > 0;)
+                refitNode(node);
+        }
+        else
+        {
+            for (size_t i = 0; i < dirtyLeaves.size(); ++i)
+            {
+                uint32_t node = dirtyLeaves[i];
+                refitNode(node);
+                for (node = parents[node]; node != NONE; node = parents[node])
+                {
+                    if (!refitNode(node))
+                        break;
+                }
+            }
+        }
+
+        for (size_t i = 0; i < dirtyLeaves.size(); ++i)
+            dirty[dirtyLeaves[i]] = 0;
+        dirtyLeaves.clear();
+    }
+
+    // Calls visit(primitive) for every primitive whose box is not entirely behind one of the planes, at most 31
+    // facing inwards like the ones of ExtractFrustum. A node inside a plane is not tested against it again
+    // below, one inside all of them passes its whole subtree without tests.
+    template <typename Visit>
+    void QueryConvex(const glm::vec4* planes, int planeCount, Visit visit)
+    {
+        if (nodeCount == 0)
+            return;
+
+        struct Entry
+        {
+            uint32_t Node;
+            uint32_t Planes;    // bit p set when the node still straddles plane p
+        };
+        Entry stack[STACK_SIZE];
+        int top = 0;
+        stack[top++] = { 0, (1u << planeCount) - 1 };
+
+        while (top > 0)
+        {
+            Entry entry = stack[--top];
+            ++NodesVisited;
+
+            uint32_t active = entry.Planes;
+            if (!testPlanes(nodes[entry.Node].Min, nodes[entry.Node].Max, planes, planeCount, active))
+                continue;
+
+            const BvhNode& node = nodes[entry.Node];
+            if (node.Count == 0)
+            {
+                stack[top++] = { node.First + 1, active };
+                stack[top++] = { node.First, active };
+                continue;
+            }
+
+            for (uint32_t i = node.First; i < node.First + node.Count; ++i)
+            {
+                const BvhBounds& box = primitives[i];
+                uint32_t primitiveActive = active;
+                if (active == 0 || testPlanes(box.Min, box.Max, planes, planeCount, primitiveActive))
+                    visit(indices[i]);
+            }
+        }
+    }
+
+    // Calls visit(primitive) for every primitive whose box overlaps the given one
+    template <typename Visit>
+    void QueryOverlap(const BvhBounds& box, Visit visit)
+    {
+        if (nodeCount == 0)
+            return;
+
+        uint32_t stack[STACK_SIZE];
+        int top = 0;
+        stack[top++] = 0;
+
+        while (top > 0)
+        {
+            const BvhNode& node = nodes[stack[--top]];
+            ++NodesVisited;
+            if (!overlaps(node.Min, node.Max, box))
+                continue;
+
+            if (node.Count == 0)
+            {
+                stack[top++] = node.First + 1;
+                stack[top++] = node.First;
+                continue;
+            }
+
+            for (uint32_t i = node.First; i < node.First + node.Count; ++i)
+            {
+                const BvhBounds& primitive = primitives[i];
+                if (overlaps(primitive.Min, primitive.Max, box))
+                    visit(indices[i]);
+            }
+        }
+    }
+
+    // Nearest primitive along the ray within maxDistance. intersect(primitive, origin, direction, maxDistance)
+    // returns the distance to the primitive's actual surface, or a negative value for a miss; it is only called
+    // for primitives whose box the ray enters closer than the nearest hit so far.
+    template <typename Intersect>
+    BvhHit Raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, Intersect intersect)
+    {
+        BvhHit hit = { NONE, maxDistance };
+        if (nodeCount == 0)
+            return hit;
+
+        glm::vec3 inverse = 1.0f / direction;
+
+        struct Entry
+        {
+            uint32_t Node;
+            float Distance;     // where the ray enters the node
+        };
+        Entry stack[STACK_SIZE];
+        int top = 0;
+        float rootDistance = rayBox(origin, inverse, nodes[0].Min, nodes[0].Max, hit.Distance);
+        if (rootDistance >= 0.0f)
+            stack[top++] = { 0, rootDistance };
+
+        while (top > 0)
+        {
+            Entry entry = stack[--top];
+
+            // a hit found since the node was pushed can be nearer than the node
+            if (entry.Distance > hit.Distance)
+                continue;
+
+            const BvhNode& node = nodes[entry.Node];
+            ++NodesVisited;
+
+            if (node.Count == 0)
+            {
+                // the nearer child is searched first, the further one is often skipped after it
+                uint32_t nearChild = node.First, farChild = node.First + 1;
+                float nearDistance = rayBox(origin, inverse, nodes[nearChild].Min, nodes[nearChild].Max, hit.Distance);
+                float farDistance = rayBox(origin, inverse, nodes[farChild].Min, nodes[farChild].Max, hit.Distance);
+                if (farDistance >= 0.0f && (nearDistance < 0.0f || farDistance < nearDistance))
+                {
+                    std::swap(nearChild, farChild);
+                    std::swap(nearDistance, farDistance);
+                }
+                if (farDistance >= 0.0f)
+                    stack[top++] = { farChild, farDistance };
+                if (nearDistance >= 0.0f)
+                    stack[top++] = { nearChild, nearDistance };
+                continue;
+            }
+
+            for (uint32_t i = node.First; i < node.First + node.Count; ++i)
+            {
+                const BvhBounds& box = primitives[i];
+                if (rayBox(origin, inverse, box.Min, box.Max, hit.Distance) < 0.0f)
+                    continue;
+
+                float distance = intersect(indices[i], origin, direction, hit.Distance);
+                if (distance >= 0.0f && distance <= hit.Distance)
+                {
+                    hit.Primitive = indices[i];
+                    hit.Distance = distance;
+                }
+            }
+        }
+        return hit;
+    }
+
+    // nearest primitive box along the ray
+    BvhHit Raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance)
+    {
+        return Raycast(origin, direction, maxDistance, [this](uint32_t primitive, const glm::vec3& o, const glm::vec3& d, float limit) {
+            return rayBox(o, 1.0f / d, Bounds(primitive).Min, Bounds(primitive).Max, limit);
+        });
+    }
+
+    // Distance along the ray to where it enters the box, 0 when it starts inside, negative when it misses or
+    // enters beyond maxDistance. inverse is 1 / direction.
+    static float rayBox(const glm::vec3& origin, const glm::vec3& inverse, const glm::vec3& boxMin, const glm::vec3& boxMax, float maxDistance)
+    {
+        glm::vec3 t0 = (boxMin - origin) * inverse;
+        glm::vec3 t1 = (boxMax - origin) * inverse;
+        glm::vec3 nearT = glm::min(t0, t1);
+        glm::vec3 farT = glm::max(t0, t1);
+        float enter = std::max(std::max(nearT.x, nearT.y), std::max(nearT.z, 0.0f));
+        float exit = std::min(std::min(farT.x, farT.y), std::min(farT.z, maxDistance));
+        return enter <= exit ? enter : -1.0f;
+    }
+
+    size_t Size() const
+    {
+        return primitives.size();
+    }
+
+    uint32_t NodeCount() const
+    {
+        return nodeCount;
+    }
+
+    const BvhNode& Root() const
+    {
+        return nodes[0];
+    }
+
+private:
+    static const int BINS = 16;
+    static const uint32_t MAX_DEPTH = 64;           // deeper nodes split at the median to bound the depth
+    static const uint32_t PARALLEL_SIZE = 16384;    // fewer primitives are not worth another thread
+    static const int STACK_SIZE = 256;              // MAX_DEPTH plus the median splits of 2^32 primitives, with room to spare
+
+    struct Bin
+    {
+        BvhBounds Bounds;
+        uint32_t Count;
+    };
+
+    // a primitive being sorted into the tree, moved with its box so the build reads memory in order
+    struct Reference
+    {
+        BvhBounds Bounds;
+        uint32_t Primitive;
+    };
+
+    // bins along one axis over a range of primitives, with the range's bounds
+    struct Binning
+    {
+        Bin Bins[BINS];
+        int BinCount;       // bins in use, a node of a few primitives does not need all of them
+        BvhBounds Bounds;
+    };
+
+    std::vector<BvhNode> nodes;
+    std::atomic<uint32_t> nodeCount;
+    std::vector<uint32_t> parents;
+    std::vector<BvhBounds> primitives;  // boxes in leaf order, each leaf owns a range of them
+    std::vector<uint32_t> indices;      // the primitive at each position of that order
+    std::vector<uint32_t> positions;    // position of each primitive in that order
+    std::vector<Reference> references;  // only kept while building
+    std::vector<uint32_t> leafOf;       // leaf holding each primitive
+    std::vector<unsigned char> dirty;   // leaves waiting for Refit
+    std::vector<uint32_t> dirtyLeaves;
+
+    static BvhBounds emptyBounds()
+    {
+        BvhBounds bounds = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+        return bounds;
+    }
+
+    static void grow(BvhBounds& bounds, const glm::vec3& boxMin, const glm::vec3& boxMax)
+    {
+        bounds.Min = glm::min(bounds.Min, boxMin);
+        bounds.Max = glm::max(bounds.Max, boxMax);
+    }
+
+    // half the surface area, which is all the heuristic compares
+    static float area(const BvhBounds& bounds)
+    {
+        glm::vec3 size = glm::max(bounds.Max - bounds.Min, glm::vec3(0.0f));
+        return size.x * size.y + size.y * size.z + size.z * size.x;
+    }
+
+    static bool overlaps(const glm::vec3& boxMin, const glm::vec3& boxMax, const BvhBounds& box)
+    {
+        return boxMin.x <= box.Max.x && boxMax.x >= box.Min.x && boxMin.y <= box.Max.y && boxMax.y >= box.Min.y
+            && boxMin.z <= box.Max.z && boxMax.z >= box.Min.z;
+    }
+
+    // false when the box is behind one of the active planes; clears the planes it is entirely in front of
+    static bool testPlanes(const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::vec4* planes, int planeCount, uint32_t& active)
+    {
+        glm::vec3 center = (boxMin + boxMax) * 0.5f;
+        glm::vec3 extent = (boxMax - boxMin) * 0.5f;
+        for (int p = 0; p < planeCount; ++p)
+        {
+            if (!(active & (1u << p)))
+                continue;
+            const glm::vec4& plane = planes[p];
+            float distance = (plane.x * center.x + plane.y * center.y) + (plane.z * center.z + plane.w);
+            float reach = std::fabs(plane.x) * extent.x + std::fabs(plane.y) * extent.y + std::fabs(plane.z) * extent.z;
+            if (distance + reach < 0.0f)
+                return false;
+            if (distance - reach >= 0.0f)
+                active &= ~(1u << p);
+        }
+        return true;
+    }
+
+    BvhBounds centroidRange(uint32_t first, uint32_t last) const
+    {
+        BvhBounds bounds = emptyBounds();
+        for (uint32_t i = first; i < last; ++i)
+        {
+            glm::vec3 centroid = (references[i].Bounds.Min + references[i].Bounds.Max) * 0.5f;
+            grow(bounds, centroid, centroid);
+        }
+        return bounds;
+    }
+
+    // bins references[first, last) by centroid along axis within centroidBounds, also gathering their bounds
+    void binRange(uint32_t first, uint32_t last, const BvhBounds& centroidBounds, int axis, int binCount, Binning& binning) const
+    {
+        binning.BinCount = binCount;
+        for (int b = 0; b < binCount; ++b)
+        {
+            binning.Bins[b].Bounds = emptyBounds();
+            binning.Bins[b].Count = 0;
+        }
+        binning.Bounds = emptyBounds();
+
+        float origin = centroidBounds.Min[axis];
+        float scale = binCount / (centroidBounds.Max[axis] - centroidBounds.Min[axis]);
+        for (uint32_t i = first; i < last; ++i)
+        {
+            const BvhBounds& box = references[i].Bounds;
+            grow(binning.Bounds, box.Min, box.Max);
+            Bin& bin = binning.Bins[binIndex(box, axis, origin, scale, binCount)];
+            grow(bin.Bounds, box.Min, box.Max);
+            ++bin.Count;
+        }
+    }
+
+    // the partition puts primitives on the same side as the binning did by computing their bin the same way
+    static int binIndex(const BvhBounds& box, int axis, float origin, float scale, int binCount)
+    {
+        float centroid = (box.Min[axis] + box.Max[axis]) * 0.5f;
+        return std::min(binCount - 1, (int)((centroid - origin) * scale));
+    }
+
+    // Runs fn(slice, first, last) over threads slices of [first, first + count), on the calling thread and up to
+    // threads - 1 others. Every slice gets its call, an empty one on the calling thread.
+    template <typename Function>
+    static void parallelSlices(uint32_t first, uint32_t count, unsigned int threads, Function fn)
+    {
+        std::vector<std::thread> workers;
+        uint32_t perThread = (count + threads - 1) / threads;
+        for (unsigned int t = 1; t < threads; ++t)
+        {
+            uint32_t sliceFirst = first + std::min(count, t * perThread);
+            uint32_t sliceLast = first + std::min(count, (t + 1) * perThread);
+            if (sliceFirst < sliceLast)
+                workers.push_back(std::thread([=] { fn(t, sliceFirst, sliceLast); }));
+            else
+                fn(t, sliceLast, sliceLast);
+        }
+        fn(0u, first, first + std::min(count, perThread));
+        for (size_t t = 0; t < workers.size(); ++t)
+            workers[t].join();
+    }
+
+    // centroidRange and binRange of a large node, each split over the threads
+    void parallelCentroids(uint32_t first, uint32_t count, unsigned int threads, BvhBounds& centroidBounds) const
+    {
+        std::vector<BvhBounds> sliceCentroids(threads, emptyBounds());
+        parallelSlices(first, count, threads, [&](unsigned int slice, uint32_t sliceFirst, uint32_t sliceLast) {
+            sliceCentroids[slice] = centroidRange(sliceFirst, sliceLast);
+        });
+        centroidBounds = emptyBounds();
+        for (unsigned int t = 0; t < threads; ++t)
+            grow(centroidBounds, sliceCentroids[t].Min, sliceCentroids[t].Max);
+    }
+
+    void parallelBinning(uint32_t first, uint32_t count, unsigned int threads, const BvhBounds& centroidBounds, int axis, Binning& binning) const
+    {
+        std::vector<Binning> sliceBins(threads);
+        parallelSlices(first, count, threads, [&](unsigned int slice, uint32_t sliceFirst, uint32_t sliceLast) {
+            binRange(sliceFirst, sliceLast, centroidBounds, axis, BINS, sliceBins[slice]);
+        });
+
+        binning = sliceBins[0];
+        for (unsigned int t = 1; t < threads; ++t)
+        {
+            grow(binning.Bounds, sliceBins[t].Bounds.Min, sliceBins[t].Bounds.Max);
+            for (int b = 0; b < BINS; ++b)
+            {
+                grow(binning.Bins[b].Bounds, sliceBins[t].Bins[b].Bounds.Min, sliceBins[t].Bins[b].Bounds.Max);
+                binning.Bins[b].Count += sliceBins[t].Bins[b].Count;
+            }
+        }
+    }
+
+    void buildNode(uint32_t node, uint32_t first, uint32_t count, uint32_t depth, unsigned int threads)
+    {
+        // centroid bounds first, the bins are spread over their longest axis
+        bool parallel = threads > 1 && count >= PARALLEL_SIZE;
+        BvhBounds centroidBounds;
+        if (parallel)
+            parallelCentroids(first, count, threads, centroidBounds);
+        else
+            centroidBounds = centroidRange(first, first + count);
+
+        glm::vec3 centroidExtent = centroidBounds.Max - centroidBounds.Min;
+        int axis = centroidExtent.x >= centroidExtent.y && centroidExtent.x >= centroidExtent.z ? 0 : (centroidExtent.y >= centroidExtent.z ? 1 : 2);
+        bool separable = centroidExtent[axis] > 0.0f;
+
+        Binning binning;
+        if (!separable)
+        {
+            binning.BinCount = 0;
+            binning.Bounds = emptyBounds();
+            for (uint32_t i = first; i < first + count; ++i)
+                grow(binning.Bounds, references[i].Bounds.Min, references[i].Bounds.Max);
+        }
+        else if (parallel)
+        {
+            parallelBinning(first, count, threads, centroidBounds, axis, binning);
+        }
+        else
+        {
+            binRange(first, first + count, centroidBounds, axis, (int)std::min<uint32_t>(BINS, count), binning);
+        }
+
+        nodes[node].Min = binning.Bounds.Min;
+        nodes[node].Max = binning.Bounds.Max;
+
+        // the cheapest split between two bins: primitives times box area on both sides
+        int binCount = binning.BinCount;
+        int bestSplit = 0;
+        float bestCost = FLT_MAX;
+        if (separable)
+        {
+            float leftCost[BINS];
+            BvhBounds bounds = emptyBounds();
+            uint32_t primitivesLeft = 0;
+            for (int b = 0; b < binCount - 1; ++b)
+            {
+                grow(bounds, binning.Bins[b].Bounds.Min, binning.Bins[b].Bounds.Max);
+                primitivesLeft += binning.Bins[b].Count;
+                leftCost[b] = primitivesLeft > 0 ? area(bounds) * primitivesLeft : 0.0f;
+            }
+
+            bounds = emptyBounds();
+            uint32_t primitivesRight = 0;
+            for (int b = binCount - 1; b > 0; --b)
+            {
+                grow(bounds, binning.Bins[b].Bounds.Min, binning.Bins[b].Bounds.Max);
+                primitivesRight += binning.Bins[b].Count;
+                float cost = leftCost[b - 1] + area(bounds) * primitivesRight;
+                if (primitivesRight > 0 && primitivesRight < count && cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestSplit = b;
+                }
+            }
+        }
+        bool splittable = bestSplit > 0;
+
+        // a leaf when testing its primitives costs no more than visiting two children, or when nothing
+        // separates the centroids. Visiting a node costs about as much as testing a primitive's box.
+        const float TRAVERSAL_COST = 1.0f;
+        float leafCost = area(binning.Bounds) * count;
+        float splitCost = area(binning.Bounds) * TRAVERSAL_COST + bestCost;
+        if (count <= MAX_LEAF_SIZE && (!splittable || leafCost <= splitCost))
+        {
+            nodes[node].First = first;
+            nodes[node].Count = count;
+            for (uint32_t i = first; i < first + count; ++i)
+                leafOf[references[i].Primitive] = node;
+            return;
+        }
+
+        uint32_t middle;
+        if (splittable && depth < MAX_DEPTH)
+        {
+            float origin = centroidBounds.Min[axis];
+            float scale = binCount / (centroidBounds.Max[axis] - centroidBounds.Min[axis]);
+            Reference* split = std::partition(references.data() + first, references.data() + first + count, [&](const Reference& reference) {
+                return binIndex(reference.Bounds, axis, origin, scale, binCount) < bestSplit;
+            });
+            middle = (uint32_t)(split - references.data());
+            if (middle == first || middle == first + count)
+                middle = first + count / 2;
+        }
+        else
+        {
+            // identical centroids or a very deep branch, halved in index order
+            middle = first + count / 2;
+        }
+
+        uint32_t left = nodeCount.fetch_add(2);
+        nodes[node].First = left;
+        nodes[node].Count = 0;
+        parents[left] = node;
+        parents[left + 1] = node;
+
+        uint32_t leftCount = middle - first;
+        if (threads > 1 && count >= PARALLEL_SIZE)
+        {
+            unsigned int leftThreads = threads / 2;
+            std::thread worker([=] { buildNode(left, first, leftCount, depth + 1, leftThreads); });
+            buildNode(left + 1, middle, count - leftCount, depth + 1, threads - leftThreads);
+            worker.join();
+        }
+        else
+        {
+            buildNode(left, first, leftCount, depth + 1, 1);
+            buildNode(left + 1, middle, count - leftCount, depth + 1, 1);
+        }
+    }
+
+    // recomputes a node's box from its primitives or children, returns false when it did not change
+    bool refitNode(uint32_t index)
+    {
+        BvhNode& node = nodes[index];
+        BvhBounds bounds = emptyBounds();
+        if (node.Count > 0)
+        {
+            for (uint32_t i = node.First; i < node.First + node.Count; ++i)
+                grow(bounds, primitives[i].Min, primitives[i].Max);
+        }
+        else
+        {
+            grow(bounds, nodes[node.First].Min, nodes[node.First].Max);
+            grow(bounds, nodes[node.First + 1].Min, nodes[node.First + 1].Max);
+        }
+
+        if (bounds.Min == node.Min && bounds.Max == node.Max)
+            return false;
+        node.Min = bounds.Min;
+        node.Max = bounds.Max;
+        return true;
+    }
+};
+#endif
@@ -0,0 +1,107 @@
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#endif
+
+// Kernels written for an instruction set above the compiler's baseline are tagged with these, so GCC
+// and Clang generate them without raising the target of the whole program. MSVC needs no tag.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CPU_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define CPU_TARGET_AVX __attribute__((target("avx")))
+#define CPU_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define CPU_TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define CPU_TARGET_SSE41
+#define CPU_TARGET_AVX
+#define CPU_TARGET_AVX2
+#define CPU_TARGET_AVX512
+#endif
+
+// Instruction sets usable at run time: supported by the CPU and, for the wide registers, saved by the OS
+struct CpuFeatures
+{
+    bool Sse2;
+    bool Sse41;
+    bool Avx;
+    bool Avx2;
+    bool Fma;
+    bool Avx512f;
+};
+
+namespace cpu
+{
+    inline void cpuid(int leaf, int subleaf, unsigned int registers[4])
+    {
+#if defined(_MSC_VER)
+        int values[4];
+        __cpuidex(values, leaf, subleaf);
+        for (int i = 0; i < 4; ++i)
+            registers[i] = (unsigned int)values[i];
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+        __cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+#else
+        registers[0] = registers[1] = registers[2] = registers[3] = 0;
+#endif
+    }
+
+    // XCR0, the register state the OS saves on a context switch
+    inline unsigned long long xgetbv()
+    {
+#if defined(_MSC_VER)
+        return _xgetbv(0);
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+        unsigned int low, high;
+        __asm__ volatile("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+        return ((unsigned long long)high << 32) | low;
+#else
+        return 0;
+#endif
+    }
+
+    inline CpuFeatures detect()
+    {
+        CpuFeatures features = { false, false, false, false, false, false };
+
+        unsigned int registers[4];
+        cpuid(0, 0, registers);
+        unsigned int maxLeaf = registers[0];
+        if (maxLeaf < 1)
+            return features;
+
+        cpuid(1, 0, registers);
+        features.Sse2 = (registers[3] & (1u << 26)) != 0;
+        features.Sse41 = (registers[2] & (1u << 19)) != 0;
+        bool osxsave = (registers[2] & (1u << 27)) != 0;
+        bool avx = (registers[2] & (1u << 28)) != 0;
+        bool fma = (registers[2] & (1u << 12)) != 0;
+
+        // the OS must save both the SSE and the AVX halves of the registers
+        unsigned long long xcr0 = osxsave ? xgetbv() : 0;
+        bool ymmSaved = (xcr0 & 0x6) == 0x6;
+        features.Avx = avx && ymmSaved;
+        features.Fma = fma && ymmSaved;
+
+        if (maxLeaf >= 7)
+        {
+            cpuid(7, 0, registers);
+            features.Avx2 = features.Avx && (registers[1] & (1u << 5)) != 0;
+
+            // AVX-512 also needs the opmask registers and both halves of zmm0-31 saved
+            bool zmmSaved = ymmSaved && (xcr0 & 0xE0) == 0xE0;
+            features.Avx512f = zmmSaved && (registers[1] & (1u << 16)) != 0;
+        }
+        return features;
+    }
+}
+
+// detected once, on first use
+inline const CpuFeatures& GetCpuFeatures()
+{
+    static const CpuFeatures features = cpu::detect();
+    return features;
+}
+#endif
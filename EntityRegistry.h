@@ -0,0 +1,396 @@
+#ifndef ENTITY_REGISTRY_H
+#define ENTITY_REGISTRY_H
+
+#include <GL/glew.h>
+
+#include <Benchmark.h>
+#include <MeshRegistry.h>
+#include <TransformKernels.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// An entity is an index into the registry's slots in the low 24 bits and the slot's generation in the high 8,
+// so a handle kept after its entity was destroyed no longer matches once the slot is reused. A slot whose
+// generation runs out is retired instead of wrapping, so a stale handle can never match again.
+typedef uint32_t Entity;
+
+const Entity NO_ENTITY = 0xFFFFFFFF;
+
+// the mesh an entity is drawn with, owned by the application
+struct MeshComponent
+{
+    const GLMesh* Mesh;
+};
+
+struct MaterialComponent
+{
+    GLuint Texture;
+};
+
+namespace ecs
+{
+    inline uint32_t index(Entity entity)
+    {
+        return entity & 0xFFFFFF;
+    }
+
+    // Sparse set bookkeeping shared by the component stores: the components of live entities are packed at
+    // the front of dense arrays, sparse maps an entity's slot to its position there.
+    class SparseSet
+    {
+    public:
+        std::vector<Entity> Entities;   // owner of each dense position
+
+        bool Has(Entity entity) const
+        {
+            uint32_t slot = index(entity);
+            return slot < sparse.size() && sparse[slot] < Entities.size() && Entities[sparse[slot]] == entity;
+        }
+
+        // dense position of a component the entity has
+        uint32_t Position(Entity entity) const
+        {
+            return sparse[index(entity)];
+        }
+
+        // appends the entity, the caller appends its component data at the same position
+        uint32_t Insert(Entity entity)
+        {
+            uint32_t slot = index(entity);
+            if (slot >= sparse.size())
+                sparse.resize(slot + 1, 0xFFFFFFFF);
+            sparse[slot] = (uint32_t)Entities.size();
+            Entities.push_back(entity);
+            return sparse[slot];
+        }
+
+        // Moves the last entity into the removed one's position, so the arrays stay packed. Returns that
+        // position, the caller moves its component data the same way.
+        uint32_t Erase(Entity entity)
+        {
+            uint32_t position = sparse[index(entity)];
+            Entity last = Entities.back();
+            Entities[position] = last;
+            sparse[index(last)] = position;
+            Entities.pop_back();
+            sparse[index(entity)] = 0xFFFFFFFF;
+            return position;
+        }
+
+    private:
+        std::vector<uint32_t> sparse;
+    };
+}
+
+// Dense storage for one component type
+template <typename T>
+class ComponentArray
+{
+public:
+    std::vector<T> Data;
+
+    bool Has(Entity entity) const
+    {
+        return set.Has(entity);
+    }
+
+    T& Get(Entity entity)
+    {
+        return Data[set.Position(entity)];
+    }
+
+    // NULL when the entity has no such component
+    const T* Find(Entity entity) const
+    {
+        return set.Has(entity) ? &Data[set.Position(entity)] : NULL;
+    }
+
+    void Set(Entity entity, const T& component)
+    {
+        if (set.Has(entity))
+        {
+            Data[set.Position(entity)] = component;
+            return;
+        }
+        set.Insert(entity);
+        Data.push_back(component);
+    }
+
+    void Remove(Entity entity)
+    {
+        if (!set.Has(entity))
+            return;
+        uint32_t position = set.Erase(entity);
+        Data[position] = Data.back();
+        Data.pop_back();
+    }
+
+    // owner of Data[i]
+    Entity Owner(size_t i) const
+    {
+        return set.Entities[i];
+    }
+
+    size_t Size() const
+    {
+        return Data.size();
+    }
+
+private:
+    ecs::SparseSet set;
+};
+
+// Transforms as a structure of arrays: every field of every entity's transform is packed in its own array,
+// so a system that only reads positions touches only position memory, and the world matrix pass streams
+// through four arrays front to back. Position i of each array belongs to the same entity.
+class TransformArray
+{
+public:
+    std::vector<glm::vec3> Positions;
+    std::vector<glm::quat> Rotations;
+    std::vector<glm::vec3> Scales;
+    std::vector<glm::mat4> Worlds;     // translate * rotate * scale, written by UpdateWorldMatrices
+
+    // a transform changed since the world matrices were last updated
+    bool Changed;
+
+    TransformArray() : Changed(false)
+    {
+    }
+
+    bool Has(Entity entity) const
+    {
+        return set.Has(entity);
+    }
+
+    // position of the entity's transform in the arrays
+    uint32_t Position(Entity entity) const
+    {
+        return set.Position(entity);
+    }
+
+    void Set(Entity entity, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale)
+    {
+        if (set.Has(entity))
+        {
+            uint32_t i = set.Position(entity);
+            Positions[i] = position;
+            Rotations[i] = rotation;
+            Scales[i] = scale;
+        }
+        else
+        {
+            set.Insert(entity);
+            Positions.push_back(position);
+            Rotations.push_back(rotation);
+            Scales.push_back(scale);
+            Worlds.push_back(glm::mat4(1.0f));
+        }
+        Changed = true;
+    }
+
+    void Remove(Entity entity)
+    {
+        if (!set.Has(entity))
+            return;
+        uint32_t i = set.Erase(entity);
+        Positions[i] = Positions.back();
+        Rotations[i] = Rotations.back();
+        Scales[i] = Scales.back();
+        Worlds[i] = Worlds.back();
+        Positions.pop_back();
+        Rotations.pop_back();
+        Scales.pop_back();
+        Worlds.pop_back();
+    }
+
+    const glm::mat4& World(Entity entity) const
+    {
+        return Worlds[set.Position(entity)];
+    }
+
+    Entity Owner(size_t i) const
+    {
+        return set.Entities[i];
+    }
+
+    size_t Size() const
+    {
+        return Positions.size();
+    }
+
+private:
+    ecs::SparseSet set;
+};
+
+// Creates and destroys entities and holds their components. Destroying an entity removes all of them.
+class EntityRegistry
+{
+public:
+    TransformArray Transforms;
+    ComponentArray<MeshComponent> Meshes;
+    ComponentArray<MaterialComponent> Materials;
+
+    EntityRegistry() : alive(0)
+    {
+    }
+
+    Entity Create()
+    {
+        uint32_t slot;
+        if (!freeSlots.empty())
+        {
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        else
+        {
+            // 24 bit slots, the last one would encode NO_ENTITY
+            slot = (uint32_t)generations.size();
+            assert(slot < 0xFFFFFF);
+            generations.push_back(0);
+        }
+        ++alive;
+        return ((Entity)generations[slot] << 24) | slot;
+    }
+
+    void Destroy(Entity entity)
+    {
+        if (!Alive(entity))
+            return;
+
+        Transforms.Remove(entity);
+        Meshes.Remove(entity);
+        Materials.Remove(entity);
+
+        uint32_t slot = ecs::index(entity);
+        if (++generations[slot] != RETIRED)
+            freeSlots.push_back(slot);
+        --alive;
+    }
+
+    bool Alive(Entity entity) const
+    {
+        uint32_t slot = ecs::index(entity);
+        return entity != NO_ENTITY && slot < generations.size() && generations[slot] != RETIRED && generations[slot] == (uint8_t)(entity >> 24);
+    }
+
+    size_t Size() const
+    {
+        return alive;
+    }
+
+private:
+    // generation of a slot that has been reused as often as 8 bits allow, it is never handed out again
+    static const uint8_t RETIRED = 0xFF;
+
+    std::vector<uint8_t> generations;
+    std::vector<uint32_t> freeSlots;
+    size_t alive;
+};
+
+// Transform system: world matrices of transforms [first, last)
+inline void UpdateWorldMatrices(TransformArray& transforms, size_t first, size_t last)
+{
+    ComposeTransforms(transforms.Positions.data(), transforms.Rotations.data(), transforms.Scales.data(), transforms.Worlds.data(), first, last);
+}
+
+// Updates every world matrix when a transform changed, split over threadCount threads, 0 for every core
+inline void UpdateWorldMatrices(TransformArray& transforms, unsigned int threadCount = 0)
+{
+    if (!transforms.Changed)
+        return;
+    transforms.Changed = false;
+
+    if (threadCount == 0)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+    // a thread is only worth starting for a few thousand matrices
+    size_t count = transforms.Size();
+    unsigned int threads = (unsigned int)std::min<size_t>(threadCount, std::max<size_t>(1, count / 4096));
+    if (threads <= 1)
+    {
+        UpdateWorldMatrices(transforms, 0, count);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    size_t perThread = (count + threads - 1) / threads;
+    for (unsigned int t = 0; t < threads; ++t)
+    {
+        size_t first = t * perThread;
+        size_t last = std::min(count, first + perThread);
+        if (first < last)
+            workers.push_back(std::thread([&transforms, first, last] { UpdateWorldMatrices(transforms, first, last); }));
+    }
+    for (size_t t = 0; t < workers.size(); ++t)
+        workers[t].join();
+}
+
+// Render system: calls draw(mesh, texture, world) for every entity with a mesh, a material and a transform
+template <typename Draw>
+void ForEachRenderable(EntityRegistry& registry, Draw draw)
+{
+    for (size_t i = 0; i < registry.Meshes.Size(); ++i)
+    {
+        Entity entity = registry.Meshes.Owner(i);
+        const MaterialComponent* material = registry.Materials.Find(entity);
+        if (!material || !registry.Transforms.Has(entity))
+            continue;
+        draw(*registry.Meshes.Data[i].Mesh, material->Texture, registry.Transforms.World(entity));
+    }
+}
+
+// --bench-ecs: world matrices of a million entities on one core and on all of them
+inline void BenchmarkEntities()
+{
+    const size_t count = 1000000;
+
+    EntityRegistry registry;
+    for (size_t i = 0; i < count; ++i)
+    {
+        Entity entity = registry.Create();
+        float f = (float)i;
+        glm::quat rotation = glm::angleAxis(f * 0.001f, glm::normalize(glm::vec3(std::sin(f), 1.0f, std::cos(f))));
+        registry.Transforms.Set(entity, glm::vec3(f * 0.01f, std::sin(f), -f * 0.02f), rotation, glm::vec3(1.0f + (i % 7) * 0.1f));
+    }
+
+    std::cout << "World matrices of " << count << " entities (" << std::thread::hardware_concurrency() << " cores):" << std::endl;
+
+    double single = BenchmarkMilliseconds([&] { registry.Transforms.Changed = true; UpdateWorldMatrices(registry.Transforms, 1); });
+    BenchmarkReport("one core", single);
+
+    std::vector<glm::mat4> reference = registry.Transforms.Worlds;
+    double all = BenchmarkMilliseconds([&] { registry.Transforms.Changed = true; UpdateWorldMatrices(registry.Transforms); });
+    BenchmarkReport("all cores", all, single);
+
+    if (!std::equal(reference.begin(), reference.end(), registry.Transforms.Worlds.begin()))
+        std::cout << "ERROR: the threaded update differs from the single threaded one" << std::endl;
+
+    // the matrices the scene used to build one object at a time with glm
+    size_t worst = 0;
+    for (size_t i = 0; i < count; i += 997)
+    {
+        glm::mat4 expected = glm::translate(glm::mat4(1.0f), registry.Transforms.Positions[i]) * glm::mat4_cast(registry.Transforms.Rotations[i]) *
+            glm::scale(glm::mat4(1.0f), registry.Transforms.Scales[i]);
+        for (int c = 0; c < 4; ++c)
+        {
+            glm::vec4 difference = glm::abs(expected[c] - registry.Transforms.Worlds[i][c]);
+            if (difference.x + difference.y + difference.z + difference.w > 1e-4f)
+                worst = i + 1;
+        }
+    }
+    if (worst)
+        std::cout << "ERROR: entity " << worst - 1 << " differs from translate * rotate * scale" << std::endl;
+}
+#endif
@@ -0,0 +1,213 @@
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// Reports files that were written since the last Poll. On Linux the directories of the watched files are
+// watched with inotify, so Poll is a single non-blocking read. Elsewhere, or when inotify is unavailable,
+// Poll compares modification times and sizes, at most every PollInterval seconds.
+class FileWatcher
+{
+public:
+    double PollInterval;
+
+    FileWatcher() : PollInterval(0.25), inotify(-1), pollOnly(false), lastPoll(Clock::now())
+    {
+    }
+
+    ~FileWatcher()
+    {
+        Stop();
+    }
+
+    bool UsesInotify() const
+    {
+        return inotify >= 0;
+    }
+
+    void Watch(const std::string& path)
+    {
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            if (files[i].Path == path)
+                return;
+        }
+
+        File file;
+        file.Path = path;
+        file.Stamp = stamp(path);
+        files.push_back(file);
+
+#ifdef __linux__
+        if (inotify < 0 && !pollOnly)
+            inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotify >= 0 && !watchDirectory(directoryOf(path)))
+        {
+            // files in a directory that cannot be watched would never be reported, poll everything instead
+            close(inotify);
+            inotify = -1;
+            pollOnly = true;
+            directories.clear();
+        }
+#endif
+    }
+
+    // paths of the watched files that changed, each reported once per Poll
+    std::vector<std::string> Poll()
+    {
+        std::vector<std::string> changed;
+
+#ifdef __linux__
+        if (inotify >= 0)
+        {
+            // editors save in place (IN_CLOSE_WRITE) or write a new file and rename it over (IN_MOVED_TO)
+            alignas(inotify_event) char buffer[4096];
+            for (;;)
+            {
+                ssize_t bytes = read(inotify, buffer, sizeof(buffer));
+                if (bytes <= 0)
+                    break;
+
+                for (char* p = buffer; p < buffer + bytes;)
+                {
+                    const inotify_event* event = (const inotify_event*)p;
+                    p += sizeof(inotify_event) + event->len;
+                    if (event->len == 0)
+                        continue;
+
+                    std::string path = directoryName(event->wd) + "/" + event->name;
+                    for (size_t i = 0; i < files.size(); ++i)
+                    {
+                        if (sameFile(files[i].Path, path))
+                            addOnce(changed, files[i].Path);
+                    }
+                }
+            }
+            return changed;
+        }
+#endif
+
+        std::chrono::duration<double> sinceLast = Clock::now() - lastPoll;
+        if (sinceLast.count() < PollInterval)
+            return changed;
+        lastPoll = Clock::now();
+
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            long long current = stamp(files[i].Path);
+            if (current != files[i].Stamp)
+            {
+                files[i].Stamp = current;
+                changed.push_back(files[i].Path);
+            }
+        }
+        return changed;
+    }
+
+    void Stop()
+    {
+#ifdef __linux__
+        if (inotify >= 0)
+            close(inotify);
+        directories.clear();
+#endif
+        inotify = -1;
+        files.clear();
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct File
+    {
+        std::string Path;
+        long long Stamp;    // modification time and size, 0 while the file is missing
+    };
+
+    struct Directory
+    {
+        int Watch;
+        std::string Path;
+    };
+
+    std::vector<File> files;
+    std::vector<Directory> directories;
+    int inotify;
+    bool pollOnly;
+    Clock::time_point lastPoll;
+
+    static long long stamp(const std::string& path)
+    {
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0)
+            return 0;
+        return ((long long)info.st_mtime << 24) ^ (long long)info.st_size;
+    }
+
+    static std::string directoryOf(const std::string& path)
+    {
+        std::string::size_type slash = path.find_last_of("/\\");
+        return slash == std::string::npos ? std::string(".") : path.substr(0, slash);
+    }
+
+    // "./a/b" and "a/b" name the same file
+    static bool sameFile(const std::string& a, const std::string& b)
+    {
+        return trimDot(a) == trimDot(b);
+    }
+
+    static std::string trimDot(const std::string& path)
+    {
+        return path.compare(0, 2, "./") == 0 ? path.substr(2) : path;
+    }
+
+    static void addOnce(std::vector<std::string>& paths, const std::string& path)
+    {
+        for (size_t i = 0; i < paths.size(); ++i)
+        {
+            if (paths[i] == path)
+                return;
+        }
+        paths.push_back(path);
+    }
+
+#ifdef __linux__
+    bool watchDirectory(const std::string& path)
+    {
+        for (size_t i = 0; i < directories.size(); ++i)
+        {
+            if (directories[i].Path == path)
+                return true;
+        }
+
+        Directory directory;
+        directory.Path = path;
+        directory.Watch = inotify_add_watch(inotify, path.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (directory.Watch < 0)
+            return false;
+        directories.push_back(directory);
+        return true;
+    }
+
+    std::string directoryName(int watch) const
+    {
+        for (size_t i = 0; i < directories.size(); ++i)
+        {
+            if (directories[i].Watch == watch)
+                return directories[i].Path;
+        }
+        return ".";
+    }
+#endif
+};
+#endif
@@ -0,0 +1,203 @@
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include <GL/glew.h>
+
+#include <atomic>
+#include <chrono>
+
+// Space handed out by FrameRing::Allocate. Data is NULL when the frame's section is full.
+struct RingAllocation
+{
+    void* Data;             // mapped memory, write only, valid until the end of the frame
+    GLintptr Offset;        // where Data is in FrameRing::Buffer
+    GLsizeiptr Size;
+};
+
+// One persistently and coherently mapped buffer split into a section per frame in flight. Per-frame data
+// (camera uniforms, per-object data, instance attributes, indirect commands) is written straight into
+// mapped memory and the draws read it from the buffer at the returned offset, so there is no
+// glBufferSubData copy and no orphaning. Every section is fenced when its frame ends and waited on before
+// it is written again; with three sections that only happens when the GPU is more than two frames behind,
+// and those waits are counted as stalls.
+//
+// Allocate may be called from any thread between BeginFrame and EndFrame, the GL calls are all made by
+// BeginFrame, EndFrame, Create and Destroy on the thread owning the context. The buffer storage has no
+// target, it can be bound as uniform, shader storage, vertex or indirect buffer.
+class FrameRing
+{
+public:
+    static const GLuint MAX_FRAMES = 4;
+
+    GLuint Buffer;
+    GLsizeiptr SectionSize;
+    GLuint FrameCount;
+
+    // statistics
+    unsigned int Frames;
+    unsigned int Stalls;            // frames that had to wait for the GPU to release their section
+    double StallMilliseconds;
+    std::atomic<unsigned int> Overflows;    // allocations that did not fit, the caller used its fallback
+    GLsizeiptr PeakBytes;           // most bytes used by one frame
+
+    FrameRing() : Buffer(0), SectionSize(0), FrameCount(0), Frames(0), Stalls(0), StallMilliseconds(0.0), Overflows(0),
+        PeakBytes(0), mapped(NULL), section(0), head(0)
+    {
+        for (GLuint i = 0; i < MAX_FRAMES; ++i)
+            fences[i] = 0;
+    }
+
+    // needs GL 4.4 or ARB_buffer_storage, otherwise callers keep streaming through their own buffers
+    bool Create(GLsizeiptr sectionSize, GLuint frames = 3)
+    {
+        if (!GLEW_VERSION_4_4 && !GLEW_ARB_buffer_storage)
+            return false;
+        if (frames < 2 || frames > MAX_FRAMES)
+            return false;
+
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        GLsizeiptr size = sectionSize * frames;
+
+        glGenBuffers(1, &Buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, Buffer);
+        glBufferStorage(GL_COPY_WRITE_BUFFER, size, NULL, flags);
+        mapped = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        if (!mapped)
+        {
+            glDeleteBuffers(1, &Buffer);
+            Buffer = 0;
+            return false;
+        }
+
+        SectionSize = sectionSize;
+        FrameCount = frames;
+        section = 0;
+        head = SectionSize;     // nothing can be allocated before the first BeginFrame
+        return true;
+    }
+
+    void Destroy()
+    {
+        for (GLuint i = 0; i < MAX_FRAMES; ++i)
+        {
+            if (fences[i])
+            {
+                glClientWaitSync(fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+                glDeleteSync(fences[i]);
+                fences[i] = 0;
+            }
+        }
+
+        if (Buffer)
+        {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, Buffer);
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            glDeleteBuffers(1, &Buffer);
+        }
+
+        Buffer = 0;
+        mapped = NULL;
+        SectionSize = 0;
+        FrameCount = 0;
+    }
+
+    bool Mapped() const
+    {
+        return mapped != NULL;
+    }
+
+    // moves to the next section, waiting for the GPU to finish the frame that last used it
+    void BeginFrame()
+    {
+        if (!mapped)
+            return;
+
+        section = (section + 1) % FrameCount;
+        GLsync fence = fences[section];
+        if (fence)
+        {
+            GLenum status = glClientWaitSync(fence, 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            {
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+                std::chrono::duration<double, std::milli> waited = std::chrono::steady_clock::now() - start;
+                ++Stalls;
+                StallMilliseconds += waited.count();
+            }
+            glDeleteSync(fence);
+            fences[section] = 0;
+        }
+        head = 0;
+    }
+
+    // fences the frame's section after its last draw was submitted
+    void EndFrame()
+    {
+        if (!mapped)
+            return;
+
+        GLsizeiptr used = head.load();
+        if (used > SectionSize)
+            used = SectionSize;
+        if (used > PeakBytes)
+            PeakBytes = used;
+
+        fences[section] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        head = SectionSize;
+        ++Frames;
+    }
+
+    // Reserves bytes in this frame's section. The offset is a multiple of alignment, which does not have to
+    // be a power of two: instance data aligned to its own size can be addressed by base instance.
+    RingAllocation Allocate(GLsizeiptr bytes, GLsizeiptr alignment = 16)
+    {
+        RingAllocation allocation = { NULL, 0, bytes };
+        if (!mapped || bytes <= 0)
+            return allocation;
+
+        GLsizeiptr sectionStart = (GLsizeiptr)section * SectionSize;
+        GLsizeiptr current = head.load();
+        GLsizeiptr begin, end;
+        do
+        {
+            if (current >= SectionSize)
+            {
+                ++Overflows;
+                return allocation;
+            }
+
+            // aligned in the whole buffer, sections do not start at multiples of odd alignments
+            GLsizeiptr absolute = sectionStart + current;
+            begin = (absolute + alignment - 1) / alignment * alignment - sectionStart;
+            end = begin + bytes;
+            if (end > SectionSize)
+            {
+                ++Overflows;
+                return allocation;
+            }
+        } while (!head.compare_exchange_weak(current, end));
+
+        allocation.Offset = sectionStart + begin;
+        allocation.Data = mapped + allocation.Offset;
+        return allocation;
+    }
+
+    // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT or GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT
+    static GLsizeiptr OffsetAlignment(GLenum alignmentQuery)
+    {
+        GLint alignment = 256;
+        glGetIntegerv(alignmentQuery, &alignment);
+        return alignment > 0 ? alignment : 256;
+    }
+
+private:
+    unsigned char* mapped;
+    GLuint section;
+    std::atomic<GLsizeiptr> head;   // bytes used in the current section
+    GLsync fences[MAX_FRAMES];
+};
+#endif
@@ -0,0 +1,135 @@
+#ifndef FRAME_UNIFORMS_H
+#define FRAME_UNIFORMS_H
+
+#include <GL/glew.h>
+
+#include <FrameRing.h>
+
+#include <glm/glm.hpp>
+
+#include <cstring>
+
+// Binding point of the FrameData uniform block, shaders declare it with layout(std140, binding = 0)
+const GLuint FRAME_DATA_BINDING = 0;
+
+// Binding point of the per-draw data of a multi-draw, a shader storage block the scene vertex shader
+// declares when MULTI_DRAW is defined
+const GLuint DRAW_DATA_BINDING = 2;
+
+// Binding point of the ObjectData uniform block, the per-object data of a single draw
+const GLuint OBJECT_DATA_BINDING = 3;
+
+// CPU side mirror of the std140 FrameData block. Member order and padding must match the GLSL declaration:
+//
+//  layout(std140, binding = 0) uniform FrameData
+//  {
+//      mat4 view;
+//      mat4 projection;
+//      mat4 viewProjection;
+//      vec4 cameraPosition;
+//      float time;
+//  };
+struct FrameData
+{
+    glm::mat4 View;
+    glm::mat4 Projection;
+    glm::mat4 ViewProjection;
+    glm::vec4 CameraPosition;   // xyz camera position, w unused
+    float Time;
+    float Padding[3];           // std140 rounds the block size up to a multiple of vec4
+};
+
+static_assert(sizeof(FrameData) == 3 * 64 + 16 + 16, "FrameData does not match the std140 layout");
+
+// Per-object data of one draw. The same layout serves the std140 ObjectData block and the std430 DrawData
+// struct of the scene vertex shader:
+//
+//  mat4 model;
+//  vec4 uvTransform;   scale in xy, offset in zw of the object's atlas region
+//  vec4 layer;         texture layer or bindless handle index in x
+struct DrawData
+{
+    glm::mat4 Model;
+    glm::vec4 UVTransform;
+    float Layer;
+    float Padding[3];
+};
+
+static_assert(sizeof(DrawData) == 64 + 16 + 16, "DrawData does not match the shader layout");
+
+// Uniform buffer holding the per-frame camera data. It is written once per frame and every shader
+// program reads it through the same binding point, so objects only need to upload their model matrix.
+class FrameUniformBuffer
+{
+public:
+    GLuint Buffer;
+    FrameData Data;
+
+    // optional, the block is written into this frame's section of the ring instead of Buffer
+    FrameRing* Ring;
+
+    FrameUniformBuffer() : Buffer(0), Data(), Ring(NULL), uniformAlignment(256)
+    {
+    }
+
+    void Create()
+    {
+        glGenBuffers(1, &Buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, Buffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameData), NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+        glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_DATA_BINDING, Buffer);
+        uniformAlignment = FrameRing::OffsetAlignment(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT);
+    }
+
+    // writes this frame's camera matrices, call once before the first draw of the frame
+    void Update(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& cameraPosition, float time)
+    {
+        Data.View = view;
+        Data.Projection = projection;
+        Data.ViewProjection = projection * view;
+        Data.CameraPosition = glm::vec4(cameraPosition, 1.0f);
+        Data.Time = time;
+
+        RingAllocation space = { NULL, 0, 0 };
+        if (Ring)
+            space = Ring->Allocate(sizeof(FrameData), uniformAlignment);
+
+        if (space.Data)
+        {
+            std::memcpy(space.Data, &Data, sizeof(FrameData));
+            glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_DATA_BINDING, Ring->Buffer, space.Offset, sizeof(FrameData));
+            return;
+        }
+
+        glBindBuffer(GL_UNIFORM_BUFFER, Buffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameData), &Data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_DATA_BINDING, Buffer);
+    }
+
+    void Destroy()
+    {
+        glDeleteBuffers(1, &Buffer);
+        Buffer = 0;
+    }
+
+    // points a program's FrameData and ObjectData blocks at the shared binding points. Programs that declare
+    // the bindings in GLSL do not need it, but calling it for every program keeps sources without the
+    // qualifier working too.
+    static void AttachProgram(GLuint programId)
+    {
+        GLuint blockIndex = glGetUniformBlockIndex(programId, "FrameData");
+        if (blockIndex != GL_INVALID_INDEX)
+            glUniformBlockBinding(programId, blockIndex, FRAME_DATA_BINDING);
+
+        blockIndex = glGetUniformBlockIndex(programId, "ObjectData");
+        if (blockIndex != GL_INVALID_INDEX)
+            glUniformBlockBinding(programId, blockIndex, OBJECT_DATA_BINDING);
+    }
+
+private:
+    GLsizeiptr uniformAlignment;
+};
+#endif
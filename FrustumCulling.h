@@ -0,0 +1,634 @@
+#ifndef FRUSTUM_CULLING_H
+#define FRUSTUM_CULLING_H
+
+#include <CpuFeatures.h>
+#include <Benchmark.h>
+#include <BoundingVolumeHierarchy.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRUSTUM_CULLING_SIMD
+#include <immintrin.h>
+#endif
+
+// The six planes of a view frustum in world space, normalized so a point's distance to a plane is
+// dot(plane.xyz, point) + plane.w, positive on the inside
+struct Frustum
+{
+    glm::vec4 Planes[6];    // left, right, bottom, top, near, far
+};
+
+// Gribb and Hartmann: a point is inside when -w <= x, y, z <= w in clip space, each of those six
+// inequalities is a plane made of two rows of the view-projection matrix
+inline Frustum ExtractFrustum(const glm::mat4& viewProjection)
+{
+    // glm matrices are indexed [column][row]
+    glm::vec4 rows[4];
+    for (int r = 0; r < 4; ++r)
+        rows[r] = glm::vec4(viewProjection[0][r], viewProjection[1][r], viewProjection[2][r], viewProjection[3][r]);
+
+    Frustum frustum;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        frustum.Planes[axis * 2] = rows[3] + rows[axis];
+        frustum.Planes[axis * 2 + 1] = rows[3] - rows[axis];
+    }
+    for (int p = 0; p < 6; ++p)
+        frustum.Planes[p] /= glm::length(glm::vec3(frustum.Planes[p]));
+    return frustum;
+}
+
+// Box test kernels, all giving the same answer:
+//  CULL_KERNEL_SSE  4 boxes per iteration
+//  CULL_KERNEL_AVX  8
+enum CullKernel
+{
+    CULL_KERNEL_AUTO,       // the widest one the CPU supports
+    CULL_KERNEL_SCALAR,     // reference
+    CULL_KERNEL_SSE,
+    CULL_KERNEL_AVX
+};
+
+namespace cull
+{
+    // Boxes as a structure of arrays of centers and half extents, so a register loads the same coordinate of
+    // consecutive boxes
+    struct Boxes
+    {
+        const float* CenterX;
+        const float* CenterY;
+        const float* CenterZ;
+        const float* ExtentX;
+        const float* ExtentY;
+        const float* ExtentZ;
+    };
+
+    // A box is outside when its corner furthest along a plane's normal is behind the plane. That corner's
+    // distance is the center's distance plus the extents projected onto the absolute normal.
+    inline void cullScalar(const Frustum& frustum, const Boxes& boxes, unsigned char* visible, size_t first, size_t last)
+    {
+        for (size_t i = first; i < last; ++i)
+        {
+            unsigned char inside = 1;
+            for (int p = 0; p < 6; ++p)
+            {
+                const glm::vec4& plane = frustum.Planes[p];
+                float distance = (plane.x * boxes.CenterX[i] + plane.y * boxes.CenterY[i]) + (plane.z * boxes.CenterZ[i] + plane.w);
+                float reach = std::fabs(plane.x) * boxes.ExtentX[i] + std::fabs(plane.y) * boxes.ExtentY[i] + std::fabs(plane.z) * boxes.ExtentZ[i];
+                if (distance + reach < 0.0f)
+                    inside = 0;
+            }
+            visible[i] = inside;
+        }
+    }
+
+#ifdef FRUSTUM_CULLING_SIMD
+    inline void cullSse(const Frustum& frustum, const Boxes& boxes, unsigned char* visible, size_t first, size_t last)
+    {
+        __m128 planes[6][7];    // x, y, z, w, |x|, |y|, |z| of each plane in every lane
+        for (int p = 0; p < 6; ++p)
+        {
+            const glm::vec4& plane = frustum.Planes[p];
+            planes[p][0] = _mm_set1_ps(plane.x);
+            planes[p][1] = _mm_set1_ps(plane.y);
+            planes[p][2] = _mm_set1_ps(plane.z);
+            planes[p][3] = _mm_set1_ps(plane.w);
+            planes[p][4] = _mm_set1_ps(std::fabs(plane.x));
+            planes[p][5] = _mm_set1_ps(std::fabs(plane.y));
+            planes[p][6] = _mm_set1_ps(std::fabs(plane.z));
+        }
+        const __m128 zero = _mm_setzero_ps();
+
+        size_t i = first;
+        for (; i + 4 <= last; i += 4)
+        {
+            __m128 cx = _mm_loadu_ps(boxes.CenterX + i), cy = _mm_loadu_ps(boxes.CenterY + i), cz = _mm_loadu_ps(boxes.CenterZ + i);
+            __m128 ex = _mm_loadu_ps(boxes.ExtentX + i), ey = _mm_loadu_ps(boxes.ExtentY + i), ez = _mm_loadu_ps(boxes.ExtentZ + i);
+
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (int p = 0; p < 6; ++p)
+            {
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planes[p][0], cx), _mm_mul_ps(planes[p][1], cy)),
+                    _mm_add_ps(_mm_mul_ps(planes[p][2], cz), planes[p][3]));
+                __m128 reach = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planes[p][4], ex), _mm_mul_ps(planes[p][5], ey)), _mm_mul_ps(planes[p][6], ez));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, reach), zero));
+            }
+
+            int mask = _mm_movemask_ps(inside);
+            for (int lane = 0; lane < 4; ++lane)
+                visible[i + lane] = (unsigned char)((mask >> lane) & 1);
+        }
+        cullScalar(frustum, boxes, visible, i, last);
+    }
+
+    CPU_TARGET_AVX inline void cullAvx(const Frustum& frustum, const Boxes& boxes, unsigned char* visible, size_t first, size_t last)
+    {
+        __m256 planes[6][7];
+        for (int p = 0; p < 6; ++p)
+        {
+            const glm::vec4& plane = frustum.Planes[p];
+            planes[p][0] = _mm256_set1_ps(plane.x);
+            planes[p][1] = _mm256_set1_ps(plane.y);
+            planes[p][2] = _mm256_set1_ps(plane.z);
+            planes[p][3] = _mm256_set1_ps(plane.w);
+            planes[p][4] = _mm256_set1_ps(std::fabs(plane.x));
+            planes[p][5] = _mm256_set1_ps(std::fabs(plane.y));
+            planes[p][6] = _mm256_set1_ps(std::fabs(plane.z));
+        }
+        const __m256 zero = _mm256_setzero_ps();
+
+        size_t i = first;
+        for (; i + 8 <= last; i += 8)
+        {
+            __m256 cx = _mm256_loadu_ps(boxes.CenterX + i), cy = _mm256_loadu_ps(boxes.CenterY + i), cz = _mm256_loadu_ps(boxes.CenterZ + i);
+            __m256 ex = _mm256_loadu_ps(boxes.ExtentX + i), ey = _mm256_loadu_ps(boxes.ExtentY + i), ez = _mm256_loadu_ps(boxes.ExtentZ + i);
+
+            __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+            for (int p = 0; p < 6; ++p)
+            {
+                __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(planes[p][0], cx), _mm256_mul_ps(planes[p][1], cy)),
+                    _mm256_add_ps(_mm256_mul_ps(planes[p][2], cz), planes[p][3]));
+                __m256 reach = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(planes[p][4], ex), _mm256_mul_ps(planes[p][5], ey)),
+                    _mm256_mul_ps(planes[p][6], ez));
+                inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, reach), zero, _CMP_GE_OQ));
+            }
+
+            int mask = _mm256_movemask_ps(inside);
+            for (int lane = 0; lane < 8; ++lane)
+                visible[i + lane] = (unsigned char)((mask >> lane) & 1);
+        }
+        cullScalar(frustum, boxes, visible, i, last);
+    }
+#endif
+
+    inline CullKernel resolveKernel(CullKernel kernel)
+    {
+#ifdef FRUSTUM_CULLING_SIMD
+        const CpuFeatures& cpu = GetCpuFeatures();
+        if (kernel == CULL_KERNEL_AUTO)
+            kernel = CULL_KERNEL_AVX;
+        if (kernel == CULL_KERNEL_AVX && !cpu.Avx)
+            kernel = CULL_KERNEL_SSE;
+        return kernel;
+#else
+        (void)kernel;
+        return CULL_KERNEL_SCALAR;
+#endif
+    }
+}
+
+// Writes visible[i] for boxes [first, last), 1 when the box intersects the frustum or is inside it. A box that
+// straddles a frustum corner outside of it can pass, it is never culled when it is visible.
+inline void CullBoxes(const Frustum& frustum, const cull::Boxes& boxes, unsigned char* visible, size_t first, size_t last,
+    CullKernel kernel = CULL_KERNEL_AUTO)
+{
+    static const CullKernel best = cull::resolveKernel(CULL_KERNEL_AUTO);
+    kernel = kernel == CULL_KERNEL_AUTO ? best : cull::resolveKernel(kernel);
+
+#ifdef FRUSTUM_CULLING_SIMD
+    if (kernel == CULL_KERNEL_AVX)
+        return cull::cullAvx(frustum, boxes, visible, first, last);
+    if (kernel == CULL_KERNEL_SSE)
+        return cull::cullSse(frustum, boxes, visible, first, last);
+#endif
+    cull::cullScalar(frustum, boxes, visible, first, last);
+}
+
+// Tests the world space bounds of the scene's objects against the camera frustum in one batch before any of
+// them is submitted. Objects are added once with their object space box and model matrix and keep their index;
+// Move updates the box of an object whose matrix changed. Every frame: SetView with the camera matrices, Cull,
+// then draw the objects IsVisible returns true for.
+//
+// With a Hierarchy and enough objects the boxes are kept in a bounding volume hierarchy instead of being
+// tested one by one. It is built on the first Cull after objects were added, Move refits the boxes that
+// changed into it, so a frame in which nothing moved only walks the tree.
+class FrustumCuller
+{
+public:
+    // fewer objects are tested faster by the SIMD kernels than by walking a tree
+    static const size_t HIERARCHY_MIN_OBJECTS = 1024;
+
+    // when false Cull passes every object, for comparing against drawing everything
+    bool Enabled;
+
+    // optional, culls large scenes hierarchically
+    BoundingVolumeHierarchy* Hierarchy;
+
+    // statistics of the last Cull
+    unsigned int Visible;
+    unsigned int Culled;
+
+    // over all frames
+    unsigned int Frames;
+    unsigned long long TotalTested;
+    unsigned long long TotalCulled;
+    unsigned long long TotalMoved;
+
+    FrustumCuller() : Enabled(true), Hierarchy(NULL), Visible(0), Culled(0), Frames(0), TotalTested(0), TotalCulled(0), TotalMoved(0),
+        hierarchyBuilt(false)
+    {
+    }
+
+    // removes every object
+    void Clear()
+    {
+        for (int a = 0; a < 3; ++a)
+        {
+            centers[a].clear();
+            extents[a].clear();
+        }
+        objectCenters.clear();
+        objectExtents.clear();
+        visible.clear();
+        hierarchyBuilt = false;
+    }
+
+    // Adds the box boundsMin, boundsMax placed by model and returns its index
+    size_t Add(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& model)
+    {
+        objectCenters.push_back((boundsMin + boundsMax) * 0.5f);
+        objectExtents.push_back((boundsMax - boundsMin) * 0.5f);
+        for (int a = 0; a < 3; ++a)
+        {
+            centers[a].push_back(0.0f);
+            extents[a].push_back(0.0f);
+        }
+        visible.push_back(1);
+        hierarchyBuilt = false;
+
+        size_t i = objectCenters.size() - 1;
+        place(i, model);
+        return i;
+    }
+
+    // the object's model matrix changed
+    void Move(size_t i, const glm::mat4& model)
+    {
+        place(i, model);
+        ++TotalMoved;
+        if (hierarchyBuilt)
+            Hierarchy->SetBounds((uint32_t)i, worldBounds(i));
+    }
+
+    void SetView(const glm::mat4& viewProjection)
+    {
+        frustum = ExtractFrustum(viewProjection);
+    }
+
+    void Cull(CullKernel kernel = CULL_KERNEL_AUTO)
+    {
+        size_t count = Size();
+        if (!Enabled)
+        {
+            visible.assign(count, 1);
+            Visible = (unsigned int)count;
+        }
+        else if (Hierarchy && count >= HIERARCHY_MIN_OBJECTS)
+        {
+            cullHierarchy();
+        }
+        else
+        {
+            CullBoxes(frustum, boxes(), visible.data(), 0, count, kernel);
+            Visible = 0;
+            for (size_t i = 0; i < count; ++i)
+                Visible += visible[i];
+        }
+        Culled = (unsigned int)count - Visible;
+
+        ++Frames;
+        TotalTested += count;
+        TotalCulled += Culled;
+    }
+
+    bool IsVisible(size_t i) const
+    {
+        return visible[i] != 0;
+    }
+
+    size_t Size() const
+    {
+        return objectCenters.size();
+    }
+
+    const Frustum& Planes() const
+    {
+        return frustum;
+    }
+
+private:
+    Frustum frustum;
+    std::vector<glm::vec3> objectCenters;   // object space box of every object
+    std::vector<glm::vec3> objectExtents;
+    std::vector<float> centers[3];          // x, y, z of every world space box
+    std::vector<float> extents[3];
+    std::vector<unsigned char> visible;
+    bool hierarchyBuilt;                    // Hierarchy holds every object, moves are refit into it
+
+    // The world space box around the object is centered on the transformed center, with the half extents
+    // projected onto the absolute matrix
+    void place(size_t i, const glm::mat4& model)
+    {
+        glm::vec3 center = glm::vec3(model * glm::vec4(objectCenters[i], 1.0f));
+        glm::mat3 absolute(glm::abs(glm::vec3(model[0])), glm::abs(glm::vec3(model[1])), glm::abs(glm::vec3(model[2])));
+        glm::vec3 extent = absolute * objectExtents[i];
+
+        for (int a = 0; a < 3; ++a)
+        {
+            centers[a][i] = center[a];
+            extents[a][i] = extent[a];
+        }
+    }
+
+    void cullHierarchy()
+    {
+        size_t count = Size();
+        if (!hierarchyBuilt)
+        {
+            std::vector<BvhBounds> bounds(count);
+            for (size_t i = 0; i < count; ++i)
+                bounds[i] = worldBounds(i);
+            Hierarchy->Build(bounds);
+            hierarchyBuilt = true;
+        }
+        Hierarchy->Refit();
+
+        std::fill(visible.begin(), visible.end(), 0);
+        std::vector<unsigned char>& result = visible;
+        unsigned int found = 0;
+        Hierarchy->QueryConvex(frustum.Planes, 6, [&result, &found](uint32_t i) { result[i] = 1; ++found; });
+        Visible = found;
+    }
+
+    BvhBounds worldBounds(size_t i) const
+    {
+        glm::vec3 center(centers[0][i], centers[1][i], centers[2][i]);
+        glm::vec3 extent(extents[0][i], extents[1][i], extents[2][i]);
+        BvhBounds bounds = { center - extent, center + extent };
+        return bounds;
+    }
+
+    cull::Boxes boxes() const
+    {
+        cull::Boxes result = { centers[0].data(), centers[1].data(), centers[2].data(), extents[0].data(), extents[1].data(), extents[2].data() };
+        return result;
+    }
+};
+
+// --bench-cull: a million boxes scattered around a camera, every kernel against the scalar one
+inline void BenchmarkFrustumCulling()
+{
+    const size_t count = 1000000;
+
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.2f, 100.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 2.0f, 10.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+    std::vector<glm::mat4> models(count);
+    std::srand(1);
+    for (size_t i = 0; i < count; ++i)
+    {
+        glm::vec3 position(std::rand() % 4000 / 10.0f - 200.0f, std::rand() % 400 / 10.0f - 20.0f, std::rand() % 4000 / 10.0f - 200.0f);
+        float size = 0.1f + std::rand() % 20 / 10.0f;
+        models[i] = glm::translate(glm::mat4(1.0f), position) * glm::scale(glm::mat4(1.0f), glm::vec3(size));
+    }
+
+    FrustumCuller culler;
+    culler.SetView(projection * view);
+    for (size_t i = 0; i < count; ++i)
+        culler.Add(glm::vec3(0.0f), glm::vec3(1.0f), models[i]);
+
+    const CullKernel kernels[] = { CULL_KERNEL_SCALAR, CULL_KERNEL_SSE, CULL_KERNEL_AVX };
+    const char* kernelNames[] = { "scalar", "SSE, 4 boxes", "AVX, 8 boxes" };
+
+    std::cout << "Frustum culling of " << count << " boxes:" << std::endl;
+
+    culler.Cull(CULL_KERNEL_SCALAR);
+    std::vector<bool> reference(count);
+    for (size_t i = 0; i < count; ++i)
+        reference[i] = culler.IsVisible(i);
+    std::cout << "  " << culler.Visible << " visible, " << culler.Culled << " culled" << std::endl;
+
+    double scalar = 0.0;
+    for (int k = 0; k < 3; ++k)
+    {
+        if (cull::resolveKernel(kernels[k]) != kernels[k])
+            continue;
+
+        culler.Cull(kernels[k]);
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (culler.IsVisible(i) != reference[i])
+            {
+                std::cout << "ERROR: " << kernelNames[k] << " disagrees with the scalar test on box " << i << std::endl;
+                break;
+            }
+        }
+
+        double ms = BenchmarkMilliseconds([&] { culler.Cull(kernels[k]); });
+        BenchmarkReport(kernelNames[k], ms, k == 0 ? 0.0 : scalar);
+        if (k == 0)
+            scalar = ms;
+    }
+
+    // A frame as URender runs it, with nothing moving and with every hundredth box moving back and forth,
+    // testing every box against walking a bounding volume hierarchy
+    BoundingVolumeHierarchy bvh;
+    FrustumCuller hierarchical;
+    hierarchical.Hierarchy = &bvh;
+    hierarchical.SetView(projection * view);
+    for (size_t i = 0; i < count; ++i)
+        hierarchical.Add(glm::vec3(0.0f), glm::vec3(1.0f), models[i]);
+    hierarchical.Cull();
+
+    std::cout << "Frames of " << count << " boxes:" << std::endl;
+    FrustumCuller* cullers[] = { &culler, &hierarchical };
+    const char* staticNames[] = { "static, every box", "static, hierarchy" };
+    const char* movingNames[] = { "1% moving, every box", "1% moving, hierarchy" };
+    double staticFrame[2], movingFrame[2];
+    for (int c = 0; c < 2; ++c)
+    {
+        FrustumCuller& frameCuller = *cullers[c];
+        staticFrame[c] = BenchmarkMilliseconds([&] {
+            frameCuller.SetView(projection * view);
+            frameCuller.Cull();
+        });
+
+        bool away = false;
+        movingFrame[c] = BenchmarkMilliseconds([&] {
+            away = !away;
+            glm::mat4 offset = glm::translate(glm::mat4(1.0f), away ? glm::vec3(0.5f, 0.0f, -0.5f) : glm::vec3(0.0f));
+            frameCuller.SetView(projection * view);
+            for (size_t i = 0; i < count; i += 100)
+                frameCuller.Move(i, offset * models[i]);
+            frameCuller.Cull();
+        });
+    }
+    for (int c = 0; c < 2; ++c)
+        BenchmarkReport(staticNames[c], staticFrame[c], c == 0 ? 0.0 : staticFrame[0]);
+    for (int c = 0; c < 2; ++c)
+        BenchmarkReport(movingNames[c], movingFrame[c], c == 0 ? 0.0 : movingFrame[0]);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (culler.IsVisible(i) != hierarchical.IsVisible(i))
+        {
+            std::cout << "ERROR: the hierarchy disagrees with the box test on box " << i << std::endl;
+            break;
+        }
+    }
+}
+
+// --bench-bvh: a million boxes in a bounding volume hierarchy, built on one core and on all of them, refit after
+// some moved, and queried against testing every box, checking that both find the same boxes
+inline void BenchmarkBoundingVolumeHierarchy()
+{
+    const size_t count = 1000000;
+    const size_t queries = 100;
+
+    std::vector<BvhBounds> bounds(count);
+    std::srand(1);
+    for (size_t i = 0; i < count; ++i)
+    {
+        glm::vec3 position(std::rand() % 4000 / 10.0f - 200.0f, std::rand() % 400 / 10.0f - 20.0f, std::rand() % 4000 / 10.0f - 200.0f);
+        float size = 0.1f + std::rand() % 20 / 10.0f;
+        bounds[i].Min = position;
+        bounds[i].Max = position + glm::vec3(size);
+    }
+
+    std::cout << "Bounding volume hierarchy over " << count << " boxes (" << std::thread::hardware_concurrency() << " cores):" << std::endl;
+
+    BoundingVolumeHierarchy bvh;
+    double single = BenchmarkMilliseconds([&] { bvh.Build(bounds, 1); }, 3);
+    BenchmarkReport("build, one core", single);
+    double all = BenchmarkMilliseconds([&] { bvh.Build(bounds); }, 3);
+    BenchmarkReport("build, all cores", all, single);
+
+    // every hundredth box moves back and forth
+    bool away = false;
+    double refit = BenchmarkMilliseconds([&] {
+        away = !away;
+        glm::vec3 offset = away ? glm::vec3(0.5f, 0.0f, -0.5f) : glm::vec3(0.0f);
+        for (size_t i = 0; i < count; i += 100)
+        {
+            BvhBounds box = { bounds[i].Min + offset, bounds[i].Max + offset };
+            bvh.SetBounds((uint32_t)i, box);
+        }
+        bvh.Refit();
+    });
+    BenchmarkReport("refit after 1% moved", refit, all);
+    for (size_t i = 0; i < count; i += 100)
+        bvh.SetBounds((uint32_t)i, bounds[i]);
+    bvh.Refit();
+
+    // frustum culling
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.2f, 100.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 2.0f, 10.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    Frustum frustum = ExtractFrustum(projection * view);
+
+    std::vector<float> centers[3], extents[3];
+    for (int a = 0; a < 3; ++a)
+    {
+        centers[a].resize(count);
+        extents[a].resize(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            centers[a][i] = (bounds[i].Min[a] + bounds[i].Max[a]) * 0.5f;
+            extents[a][i] = (bounds[i].Max[a] - bounds[i].Min[a]) * 0.5f;
+        }
+    }
+    cull::Boxes boxes = { centers[0].data(), centers[1].data(), centers[2].data(), extents[0].data(), extents[1].data(), extents[2].data() };
+
+    std::vector<unsigned char> linear(count), hierarchical(count);
+    double linearCull = BenchmarkMilliseconds([&] { CullBoxes(frustum, boxes, linear.data(), 0, count); });
+    BenchmarkReport("frustum, every box", linearCull);
+    double treeCull = BenchmarkMilliseconds([&] {
+        std::fill(hierarchical.begin(), hierarchical.end(), 0);
+        bvh.QueryConvex(frustum.Planes, 6, [&hierarchical](uint32_t i) { hierarchical[i] = 1; });
+    });
+    BenchmarkReport("frustum, hierarchy", treeCull, linearCull);
+    if (linear != hierarchical)
+        std::cout << "ERROR: the hierarchy and the box test disagree on what is visible" << std::endl;
+
+    // ray casts from around the origin in every direction
+    std::vector<glm::vec3> origins(queries), directions(queries);
+    for (size_t q = 0; q < queries; ++q)
+    {
+        origins[q] = glm::vec3(std::rand() % 200 / 10.0f - 10.0f, 0.0f, std::rand() % 200 / 10.0f - 10.0f);
+        float angle = std::rand() % 6283 / 1000.0f;
+        directions[q] = glm::normalize(glm::vec3(std::cos(angle), std::rand() % 100 / 1000.0f - 0.05f, std::sin(angle)));
+    }
+
+    std::vector<BvhHit> bruteHits(queries), treeHits(queries);
+    double bruteRays = BenchmarkMilliseconds([&] {
+        for (size_t q = 0; q < queries; ++q)
+        {
+            BvhHit hit = { BoundingVolumeHierarchy::NONE, 1000.0f };
+            glm::vec3 inverse = 1.0f / directions[q];
+            for (size_t i = 0; i < count; ++i)
+            {
+                float distance = BoundingVolumeHierarchy::rayBox(origins[q], inverse, bounds[i].Min, bounds[i].Max, hit.Distance);
+                if (distance >= 0.0f && distance <= hit.Distance)
+                {
+                    hit.Primitive = (uint32_t)i;
+                    hit.Distance = distance;
+                }
+            }
+            bruteHits[q] = hit;
+        }
+    }, 1);
+    BenchmarkReport("100 ray casts, every box", bruteRays);
+    double treeRays = BenchmarkMilliseconds([&] {
+        for (size_t q = 0; q < queries; ++q)
+            treeHits[q] = bvh.Raycast(origins[q], directions[q], 1000.0f);
+    });
+    BenchmarkReport("100 ray casts, hierarchy", treeRays, bruteRays);
+    for (size_t q = 0; q < queries; ++q)
+    {
+        // equally near boxes can be reported either way
+        if (treeHits[q].Primitive != bruteHits[q].Primitive && treeHits[q].Distance != bruteHits[q].Distance)
+        {
+            std::cout << "ERROR: ray " << q << " hit a different box in the hierarchy" << std::endl;
+            break;
+        }
+    }
+
+    // overlap queries, boxes of 10 units
+    std::vector<size_t> bruteOverlaps(queries), treeOverlaps(queries);
+    double bruteOverlap = BenchmarkMilliseconds([&] {
+        for (size_t q = 0; q < queries; ++q)
+        {
+            BvhBounds box = { origins[q] - glm::vec3(5.0f), origins[q] + glm::vec3(5.0f) };
+            size_t found = 0;
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (bounds[i].Min.x <= box.Max.x && bounds[i].Max.x >= box.Min.x && bounds[i].Min.y <= box.Max.y && bounds[i].Max.y >= box.Min.y
+                    && bounds[i].Min.z <= box.Max.z && bounds[i].Max.z >= box.Min.z)
+                    ++found;
+            }
+            bruteOverlaps[q] = found;
+        }
+    }, 1);
+    BenchmarkReport("100 overlap queries, every box", bruteOverlap);
+    double treeOverlap = BenchmarkMilliseconds([&] {
+        for (size_t q = 0; q < queries; ++q)
+        {
+            BvhBounds box = { origins[q] - glm::vec3(5.0f), origins[q] + glm::vec3(5.0f) };
+            size_t found = 0;
+            bvh.QueryOverlap(box, [&found](uint32_t) { ++found; });
+            treeOverlaps[q] = found;
+        }
+    });
+    BenchmarkReport("100 overlap queries, hierarchy", treeOverlap, bruteOverlap);
+    if (bruteOverlaps != treeOverlaps)
+        std::cout << "ERROR: the hierarchy found different overlapping boxes" << std::endl;
+}
+#endif
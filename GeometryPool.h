@@ -0,0 +1,352 @@
+#ifndef GEOMETRY_POOL_H
+#define GEOMETRY_POOL_H
+
+#include <GL/glew.h>
+
+#include <FrameRing.h>
+#include <FrameUniforms.h>
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+// Where one mesh lives in the pool's buffers
+struct PoolMesh
+{
+    GLuint FirstIndex;
+    GLuint IndexCount;
+    GLint BaseVertex;
+};
+
+// Suballocates every mesh from one vertex buffer and one index buffer behind a single VAO, so any number of
+// meshes can be drawn without rebinding anything. Vertices have the layout UCreateCube produces: position
+// (3 floats) and texture coordinates (2 floats). Indices are unsigned shorts relative to each mesh, the draw
+// adds BaseVertex. Meshes stay until Destroy, the scene never unloads geometry while it runs.
+//
+// The VAO also reads attribute DRAW_INDEX_LOCATION from a buffer holding 0, 1, 2... with a divisor of one,
+// so a draw started at base instance i sees i there: the fallback for gl_DrawIDARB.
+class GeometryPool
+{
+public:
+    static const GLuint DRAW_INDEX_LOCATION = 8;
+    static const GLuint FLOATS_PER_VERTEX = 5;
+
+    GLuint Vao;
+    GLuint VertexBuffer;
+    GLuint IndexBuffer;
+    GLuint DrawIndexBuffer;
+
+    GeometryPool() : Vao(0), VertexBuffer(0), IndexBuffer(0), DrawIndexBuffer(0),
+        vertexCount(0), vertexCapacity(0), indexCount(0), indexCapacity(0), drawIndexCapacity(0)
+    {
+    }
+
+    void Create(GLuint vertices = 1 << 16, GLuint indices = 1 << 18)
+    {
+        glGenVertexArrays(1, &Vao);
+        glBindVertexArray(Vao);
+
+        // formats are set once, growing a buffer only rebinds it
+        glVertexAttribFormat(0, 3, GL_FLOAT, GL_FALSE, 0);
+        glVertexAttribBinding(0, 0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribFormat(1, 2, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 3);
+        glVertexAttribBinding(1, 0);
+        glEnableVertexAttribArray(1);
+
+        glVertexAttribIFormat(DRAW_INDEX_LOCATION, 1, GL_UNSIGNED_INT, 0);
+        glVertexAttribBinding(DRAW_INDEX_LOCATION, 1);
+        glVertexBindingDivisor(1, 1);
+        glEnableVertexAttribArray(DRAW_INDEX_LOCATION);
+
+        glBindVertexArray(0);
+
+        reserveVertices(vertices);
+        reserveIndices(indices);
+        ReserveDraws(1024);
+    }
+
+    void Destroy()
+    {
+        glDeleteVertexArrays(1, &Vao);
+        glDeleteBuffers(1, &VertexBuffer);
+        glDeleteBuffers(1, &IndexBuffer);
+        glDeleteBuffers(1, &DrawIndexBuffer);
+        *this = GeometryPool();
+    }
+
+    // Copies a mesh into the pool and returns its 1-based handle, 0 when it cannot be pooled. Meshes added
+    // again under the same nonzero key share the first copy.
+    GLuint Add(uint64_t key, const GLfloat* vertices, GLuint newVertices, const GLushort* indices, GLuint newIndices, GLuint floatsPerVertex)
+    {
+        if (floatsPerVertex != FLOATS_PER_VERTEX || newVertices == 0 || newIndices == 0)
+            return 0;
+
+        if (key != 0)
+        {
+            std::unordered_map<uint64_t, GLuint>::const_iterator found = handles.find(key);
+            if (found != handles.end())
+                return found->second;
+        }
+
+        reserveVertices(vertexCount + newVertices);
+        reserveIndices(indexCount + newIndices);
+
+        glBindBuffer(GL_ARRAY_BUFFER, VertexBuffer);
+        glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)vertexCount * FLOATS_PER_VERTEX * sizeof(GLfloat), (GLsizeiptr)newVertices * FLOATS_PER_VERTEX * sizeof(GLfloat), vertices);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        // the element buffer binding is VAO state, upload through the copy target instead
+        glBindBuffer(GL_COPY_WRITE_BUFFER, IndexBuffer);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)indexCount * sizeof(GLushort), (GLsizeiptr)newIndices * sizeof(GLushort), indices);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        PoolMesh mesh;
+        mesh.FirstIndex = indexCount;
+        mesh.IndexCount = newIndices;
+        mesh.BaseVertex = (GLint)vertexCount;
+        meshes.push_back(mesh);
+
+        vertexCount += newVertices;
+        indexCount += newIndices;
+
+        GLuint handle = (GLuint)meshes.size();
+        if (key != 0)
+            handles[key] = handle;
+        return handle;
+    }
+
+    const PoolMesh& Mesh(GLuint handle) const
+    {
+        return meshes[handle - 1];
+    }
+
+    size_t Meshes() const
+    {
+        return meshes.size();
+    }
+
+    // makes the draw index attribute cover at least draws draws
+    void ReserveDraws(GLuint draws)
+    {
+        if (draws <= drawIndexCapacity)
+            return;
+
+        GLuint capacity = drawIndexCapacity > 0 ? drawIndexCapacity : 1024;
+        while (capacity < draws)
+            capacity *= 2;
+
+        std::vector<GLuint> values(capacity);
+        for (GLuint i = 0; i < capacity; ++i)
+            values[i] = i;
+
+        if (DrawIndexBuffer == 0)
+            glGenBuffers(1, &DrawIndexBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, DrawIndexBuffer);
+        glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(GLuint), values.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        drawIndexCapacity = capacity;
+
+        glBindVertexArray(Vao);
+        glBindVertexBuffer(1, DrawIndexBuffer, 0, sizeof(GLuint));
+        glBindVertexArray(0);
+    }
+
+private:
+    std::vector<PoolMesh> meshes;
+    std::unordered_map<uint64_t, GLuint> handles;
+    GLuint vertexCount;
+    GLuint vertexCapacity;
+    GLuint indexCount;
+    GLuint indexCapacity;
+    GLuint drawIndexCapacity;
+
+    // grows a buffer to at least bytes, keeping the first used bytes, and returns the new buffer
+    static GLuint grow(GLuint buffer, GLsizeiptr used, GLsizeiptr bytes)
+    {
+        GLuint grown = 0;
+        glGenBuffers(1, &grown);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+        glBufferData(GL_COPY_WRITE_BUFFER, bytes, NULL, GL_STATIC_DRAW);
+        if (buffer != 0 && used > 0)
+        {
+            glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        glDeleteBuffers(1, &buffer);
+        return grown;
+    }
+
+    static GLuint nextCapacity(GLuint capacity, GLuint needed)
+    {
+        capacity = capacity > 0 ? capacity : 1024;
+        while (capacity < needed)
+            capacity *= 2;
+        return capacity;
+    }
+
+    void reserveVertices(GLuint needed)
+    {
+        if (needed <= vertexCapacity && VertexBuffer != 0)
+            return;
+
+        vertexCapacity = nextCapacity(vertexCapacity, needed);
+        const GLsizeiptr vertexBytes = FLOATS_PER_VERTEX * sizeof(GLfloat);
+        VertexBuffer = grow(VertexBuffer, vertexCount * vertexBytes, vertexCapacity * vertexBytes);
+
+        glBindVertexArray(Vao);
+        glBindVertexBuffer(0, VertexBuffer, 0, (GLsizei)vertexBytes);
+        glBindVertexArray(0);
+    }
+
+    void reserveIndices(GLuint needed)
+    {
+        if (needed <= indexCapacity && IndexBuffer != 0)
+            return;
+
+        indexCapacity = nextCapacity(indexCapacity, needed);
+        IndexBuffer = grow(IndexBuffer, indexCount * sizeof(GLushort), indexCapacity * sizeof(GLushort));
+
+        glBindVertexArray(Vao);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, IndexBuffer);
+        glBindVertexArray(0);
+    }
+};
+
+// Collects the draws of a frame as DrawElementsIndirectCommands over a GeometryPool and submits all of them
+// with one glMultiDrawElementsIndirect. The shader finds each draw's DrawData by gl_DrawIDARB where
+// ARB_shader_draw_parameters is supported, otherwise through the pool's draw index attribute, which is why
+// every command's base instance is its own index.
+class MultiDrawBatch
+{
+public:
+    GLuint CommandBuffer;
+    GLuint DrawDataBuffer;
+
+    // optional, commands and draw data are written into it instead of being streamed through the buffers above
+    FrameRing* Ring;
+
+    // draws submitted by the last Draw
+    unsigned int Draws;
+
+    MultiDrawBatch() : CommandBuffer(0), DrawDataBuffer(0), Ring(NULL), Draws(0), storageAlignment(16)
+    {
+    }
+
+    static bool DrawParameters()
+    {
+        return GLEW_ARB_shader_draw_parameters != 0;
+    }
+
+    void Create()
+    {
+        glGenBuffers(1, &CommandBuffer);
+        glGenBuffers(1, &DrawDataBuffer);
+        storageAlignment = FrameRing::OffsetAlignment(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT);
+    }
+
+    void Destroy()
+    {
+        glDeleteBuffers(1, &CommandBuffer);
+        glDeleteBuffers(1, &DrawDataBuffer);
+        CommandBuffer = 0;
+        DrawDataBuffer = 0;
+    }
+
+    void Clear()
+    {
+        commands.clear();
+        draws.clear();
+    }
+
+    void Add(const PoolMesh& mesh, const glm::mat4& model, float layer, const glm::vec4& uvTransform)
+    {
+        Command command;
+        command.Count = mesh.IndexCount;
+        command.InstanceCount = 1;
+        command.FirstIndex = mesh.FirstIndex;
+        command.BaseVertex = mesh.BaseVertex;
+        command.BaseInstance = (GLuint)commands.size();
+        commands.push_back(command);
+
+        DrawData data;
+        data.Model = model;
+        data.UVTransform = uvTransform;
+        data.Layer = layer;
+        data.Padding[0] = data.Padding[1] = data.Padding[2] = 0.0f;
+        draws.push_back(data);
+    }
+
+    size_t Size() const
+    {
+        return commands.size();
+    }
+
+    // uploads the commands and draw data and issues them, the caller binds the program and textures
+    void Draw(GeometryPool& pool)
+    {
+        Draws = (unsigned int)commands.size();
+        if (commands.empty())
+            return;
+
+        pool.ReserveDraws((GLuint)commands.size());
+
+        GLsizeiptr commandBytes = (GLsizeiptr)(commands.size() * sizeof(Command));
+        GLsizeiptr drawBytes = (GLsizeiptr)(draws.size() * sizeof(DrawData));
+        RingAllocation commandSpace = { NULL, 0, 0 };
+        RingAllocation drawSpace = { NULL, 0, 0 };
+        if (Ring)
+        {
+            commandSpace = Ring->Allocate(commandBytes, sizeof(GLuint));
+            drawSpace = Ring->Allocate(drawBytes, storageAlignment);
+        }
+
+        const void* indirect = NULL;
+        if (commandSpace.Data && drawSpace.Data)
+        {
+            std::memcpy(commandSpace.Data, commands.data(), (size_t)commandBytes);
+            std::memcpy(drawSpace.Data, draws.data(), (size_t)drawBytes);
+
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, Ring->Buffer);
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, DRAW_DATA_BINDING, Ring->Buffer, drawSpace.Offset, drawBytes);
+            indirect = (const void*)commandSpace.Offset;
+        }
+        else
+        {
+            // orphaned every frame so the driver never waits for the previous frame's draws
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, CommandBuffer);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, commandBytes, commands.data(), GL_STREAM_DRAW);
+
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, DrawDataBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, drawBytes, draws.data(), GL_STREAM_DRAW);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_DATA_BINDING, DrawDataBuffer);
+        }
+
+        glBindVertexArray(pool.Vao);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_SHORT, indirect, (GLsizei)commands.size(), 0);
+        glBindVertexArray(0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+
+private:
+    // DrawElementsIndirectCommand as glMultiDrawElementsIndirect reads it
+    struct Command
+    {
+        GLuint Count;
+        GLuint InstanceCount;
+        GLuint FirstIndex;
+        GLint BaseVertex;
+        GLuint BaseInstance;
+    };
+
+    std::vector<Command> commands;
+    std::vector<DrawData> draws;
+    GLsizeiptr storageAlignment;
+};
+#endif
@@ -0,0 +1,33 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+const uint64_t HASH_SEED = 14695981039346656037ULL;
+
+// FNV-1a style hash used to key caches by the contents of geometry, images and shader sources.
+// It consumes eight bytes per step so hashing large images stays cheap, and finishes with a
+// 64 bit mix so nearby inputs spread over the whole range.
+inline uint64_t HashBytes(const void* data, size_t bytes, uint64_t hash = HASH_SEED)
+{
+    const uint64_t prime = 1099511628211ULL;
+    const unsigned char* p = (const unsigned char*)data;
+
+    size_t i = 0;
+    for (; i + 8 <= bytes; i += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, p + i, sizeof(word));
+        hash = (hash ^ word) * prime;
+    }
+    for (; i < bytes; ++i)
+        hash = (hash ^ p[i]) * prime;
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+#endif
@@ -0,0 +1,98 @@
+#ifndef IMAGE_UTILS_H
+#define IMAGE_UTILS_H
+
+#include <stb_image.h>
+
+#include <Benchmark.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// Images are loaded with Y axis going down, but OpenGL's Y axis goes up, so let's flip it.
+// Whole rows are swapped through a row-sized scratch buffer, memcpy moves them with the widest
+// vector instructions the C runtime has.
+inline void flipImageVertically(unsigned char* image, int width, int height, int channels)
+{
+    size_t rowBytes = (size_t)width * channels;
+    std::vector<unsigned char> scratch(rowBytes);
+
+    unsigned char* top = image;
+    unsigned char* bottom = image + (size_t)(height - 1) * rowBytes;
+    for (int j = 0; j < height / 2; ++j)
+    {
+        std::memcpy(scratch.data(), top, rowBytes);
+        std::memcpy(top, bottom, rowBytes);
+        std::memcpy(bottom, scratch.data(), rowBytes);
+        top += rowBytes;
+        bottom -= rowBytes;
+    }
+}
+
+// The original byte-at-a-time flip, kept as the reference for the benchmark
+inline void flipImageVerticallyBytewise(unsigned char* image, int width, int height, int channels)
+{
+    for (int j = 0; j < height / 2; ++j)
+    {
+        int index1 = j * width * channels;
+        int index2 = (height - 1 - j) * width * channels;
+
+        for (int i = width * channels; i > 0; --i)
+        {
+            unsigned char tmp = image[index1];
+            image[index1] = image[index2];
+            image[index2] = tmp;
+            ++index1;
+            ++index2;
+        }
+    }
+}
+
+// --bench-flip [file]: compares the flips on a synthetic 8K RGBA image, and with a file also compares
+// decoding plus row swap against stb_image's flip-on-load
+inline void BenchmarkImageFlip(const char* file)
+{
+    const int width = 7680;
+    const int height = 4320;
+    const int channels = 4;
+
+    std::vector<unsigned char> image((size_t)width * height * channels);
+    for (size_t i = 0; i < image.size(); ++i)
+        image[i] = (unsigned char)(i * 31);
+
+    std::vector<unsigned char> expected(image);
+    flipImageVerticallyBytewise(expected.data(), width, height, channels);
+    std::vector<unsigned char> actual(image);
+    flipImageVertically(actual.data(), width, height, channels);
+    if (actual != expected)
+    {
+        std::cout << "ERROR: row swap flip does not match the reference" << std::endl;
+        return;
+    }
+
+    std::cout << "Vertical flip, " << width << "x" << height << " RGBA:" << std::endl;
+    double bytewise = BenchmarkMilliseconds([&] { flipImageVerticallyBytewise(image.data(), width, height, channels); }, 5);
+    BenchmarkReport("byte swap loop", bytewise);
+    BenchmarkReport("row swap (memcpy)", BenchmarkMilliseconds([&] { flipImageVertically(image.data(), width, height, channels); }, 5), bytewise);
+
+    if (!file)
+        return;
+
+    int w, h, c;
+    std::cout << "Decode and flip " << file << ":" << std::endl;
+    double decodeOnly = BenchmarkMilliseconds([&] { stbi_image_free(stbi_load(file, &w, &h, &c, 0)); }, 3);
+    BenchmarkReport("decode only", decodeOnly);
+    BenchmarkReport("decode + row swap", BenchmarkMilliseconds([&]
+    {
+        unsigned char* pixels = stbi_load(file, &w, &h, &c, 0);
+        if (pixels)
+            flipImageVertically(pixels, w, h, c);
+        stbi_image_free(pixels);
+    }, 3), decodeOnly);
+
+    stbi_set_flip_vertically_on_load(1);
+    BenchmarkReport("decode with stb flip-on-load", BenchmarkMilliseconds([&] { stbi_image_free(stbi_load(file, &w, &h, &c, 0)); }, 3), decodeOnly);
+    stbi_set_flip_vertically_on_load(0);
+}
+#endif
@@ -0,0 +1,264 @@
+#ifndef INSTANCE_BATCH_H
+#define INSTANCE_BATCH_H
+
+#include <GL/glew.h>
+
+#include <FrameRing.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <vector>
+
+// Per-instance attributes read by the instanced vertex shader
+struct InstanceData
+{
+    glm::mat4 Model;        // attribute locations 2 to 5, one column each
+    float Layer;            // attribute location 6, texture layer of the instance
+    float Padding[3];       // keeps every instance 16 byte aligned
+    glm::vec4 UVTransform;  // attribute location 7, scale and offset of the instance's atlas region
+};
+
+// Draws many copies of one indexed mesh with glDrawElementsInstanced. The batch owns its own VAO that
+// reuses the mesh's vertex and index buffers and adds a streamed instance buffer with one model matrix and
+// texture layer per copy. Instances are collected every frame with Add and submitted with Draw.
+//
+// With a FrameRing the instances are written into the ring instead, at an offset that is a multiple of
+// sizeof(InstanceData), and the draws start at the matching base instance. The attributes point at whichever
+// of the two buffers the frame used.
+class InstanceBatch
+{
+public:
+    static const GLuint MODEL_LOCATION = 2;
+    static const GLuint LAYER_LOCATION = 6;
+    static const GLuint UV_TRANSFORM_LOCATION = 7;
+
+    GLuint Vao;
+    GLuint InstanceBuffer;
+    GLsizei IndexCount;
+    GLsizei Capacity;
+
+    // optional, set before the first Draw
+    FrameRing* Ring;
+
+    // draw calls issued by the last Draw
+    unsigned int DrawCalls;
+
+    InstanceBatch() : Vao(0), InstanceBuffer(0), IndexCount(0), Capacity(0), Ring(NULL), DrawCalls(0),
+        attributeSource(0), baseInstance(0)
+    {
+    }
+
+    // vertexBuffer must hold interleaved position (3 floats) and texture coordinates (2 floats),
+    // the layout UCreateCube produces. elementBuffer holds unsigned short indices.
+    void Create(GLuint vertexBuffer, GLuint elementBuffer, GLsizei indexCount)
+    {
+        const GLuint floatsPerVertex = 3;
+        const GLuint floatsPerUV = 2;
+        GLint stride = sizeof(float) * (floatsPerVertex + floatsPerUV);
+
+        IndexCount = indexCount;
+
+        glGenVertexArrays(1, &Vao);
+        glBindVertexArray(Vao);
+
+        // per-vertex data shared with the regular mesh
+        glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBuffer);
+
+        glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
+        glEnableVertexAttribArray(0);
+
+        glVertexAttribPointer(1, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(float) * floatsPerVertex));
+        glEnableVertexAttribArray(1);
+
+        // per-instance data, advances once per instance instead of once per vertex
+        glGenBuffers(1, &InstanceBuffer);
+        for (GLuint column = 0; column < 4; ++column)
+        {
+            glEnableVertexAttribArray(MODEL_LOCATION + column);
+            glVertexAttribDivisor(MODEL_LOCATION + column, 1);
+        }
+        glEnableVertexAttribArray(LAYER_LOCATION);
+        glVertexAttribDivisor(LAYER_LOCATION, 1);
+        glEnableVertexAttribArray(UV_TRANSFORM_LOCATION);
+        glVertexAttribDivisor(UV_TRANSFORM_LOCATION, 1);
+        pointAttributes(InstanceBuffer);
+
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void Destroy()
+    {
+        glDeleteBuffers(1, &InstanceBuffer);
+        glDeleteVertexArrays(1, &Vao);
+        InstanceBuffer = 0;
+        Vao = 0;
+        Capacity = 0;
+        attributeSource = 0;
+    }
+
+    void Clear()
+    {
+        instances.clear();
+    }
+
+    // queues one copy of the mesh. texture is bound for the copy when no texture array is used,
+    // layer and uvTransform select the copy's region when one is.
+    void Add(const glm::mat4& model, GLuint texture, float layer = 0.0f, const glm::vec4& uvTransform = glm::vec4(1.0f, 1.0f, 0.0f, 0.0f))
+    {
+        Entry entry;
+        entry.Data.Model = model;
+        entry.Data.Layer = layer;
+        entry.Data.UVTransform = uvTransform;
+        entry.Texture = texture;
+        instances.push_back(entry);
+    }
+
+    size_t Size() const
+    {
+        return instances.size();
+    }
+
+    // Uploads the queued instances and draws them. With a texture array every instance is drawn by a single
+    // glDrawElementsInstanced call; with plain 2D textures instances are grouped by texture and each group
+    // is one instanced call starting at its own base instance.
+    void Draw(GLuint textureArray = 0)
+    {
+        DrawCalls = 0;
+        if (instances.empty())
+            return;
+
+        // group instances sharing a texture so each group is a contiguous range of the instance buffer
+        if (textureArray == 0)
+            std::stable_sort(instances.begin(), instances.end(), [](const Entry& a, const Entry& b) { return a.Texture < b.Texture; });
+
+        glBindVertexArray(Vao);
+        upload();
+        glActiveTexture(GL_TEXTURE0);
+
+        if (textureArray != 0)
+        {
+            glBindTexture(GL_TEXTURE_2D_ARRAY, textureArray);
+            drawAll();
+        }
+        else
+        {
+            drawGroups(true);
+        }
+
+        glBindVertexArray(0);
+    }
+
+    // Draws with bindless textures, the layer of each instance indexing the handle table. Nothing is bound;
+    // without non-uniform handle support instances are still split by texture so the index is uniform
+    // within each call.
+    void DrawBindless(bool nonUniformHandles)
+    {
+        DrawCalls = 0;
+        if (instances.empty())
+            return;
+
+        if (!nonUniformHandles)
+            std::stable_sort(instances.begin(), instances.end(), [](const Entry& a, const Entry& b) { return a.Texture < b.Texture; });
+
+        glBindVertexArray(Vao);
+        upload();
+        if (nonUniformHandles)
+            drawAll();
+        else
+            drawGroups(false);
+        glBindVertexArray(0);
+    }
+
+private:
+    struct Entry
+    {
+        InstanceData Data;
+        GLuint Texture;
+    };
+
+    std::vector<Entry> instances;
+    std::vector<InstanceData> staging;
+    GLuint attributeSource;     // buffer the instance attributes of the VAO read from
+    GLuint baseInstance;        // first instance of this frame's data in that buffer
+
+    void drawAll()
+    {
+        glDrawElementsInstancedBaseInstance(GL_TRIANGLES, IndexCount, GL_UNSIGNED_SHORT, NULL, (GLsizei)instances.size(), baseInstance);
+        ++DrawCalls;
+    }
+
+    // one call per run of instances sharing a texture, instances must be sorted by texture
+    void drawGroups(bool bindTextures)
+    {
+        size_t first = 0;
+        while (first < instances.size())
+        {
+            size_t last = first + 1;
+            while (last < instances.size() && instances[last].Texture == instances[first].Texture)
+                ++last;
+
+            if (bindTextures)
+                glBindTexture(GL_TEXTURE_2D, instances[first].Texture);
+            glDrawElementsInstancedBaseInstance(GL_TRIANGLES, IndexCount, GL_UNSIGNED_SHORT, NULL, (GLsizei)(last - first), baseInstance + (GLuint)first);
+            ++DrawCalls;
+
+            first = last;
+        }
+    }
+
+    // points the instance attributes of the bound VAO at buffer, starting at offset 0
+    void pointAttributes(GLuint buffer)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        for (GLuint column = 0; column < 4; ++column)
+            glVertexAttribPointer(MODEL_LOCATION + column, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (char*)(sizeof(glm::vec4) * column));
+        glVertexAttribPointer(LAYER_LOCATION, 1, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (char*)(sizeof(glm::mat4)));
+        glVertexAttribPointer(UV_TRANSFORM_LOCATION, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (char*)(sizeof(glm::mat4) + sizeof(glm::vec4)));
+        attributeSource = buffer;
+    }
+
+    // writes the queued instances where the bound VAO reads them and sets the base instance of the draws
+    void upload()
+    {
+        GLsizeiptr bytes = (GLsizeiptr)(instances.size() * sizeof(InstanceData));
+
+        RingAllocation space = { NULL, 0, 0 };
+        if (Ring)
+            space = Ring->Allocate(bytes, sizeof(InstanceData));
+
+        if (space.Data)
+        {
+            InstanceData* target = (InstanceData*)space.Data;
+            for (size_t i = 0; i < instances.size(); ++i)
+                target[i] = instances[i].Data;
+
+            if (attributeSource != Ring->Buffer)
+                pointAttributes(Ring->Buffer);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            baseInstance = (GLuint)(space.Offset / (GLintptr)sizeof(InstanceData));
+            return;
+        }
+
+        staging.resize(instances.size());
+        for (size_t i = 0; i < instances.size(); ++i)
+            staging[i] = instances[i].Data;
+
+        if (attributeSource != InstanceBuffer)
+            pointAttributes(InstanceBuffer);
+        baseInstance = 0;
+
+        glBindBuffer(GL_ARRAY_BUFFER, InstanceBuffer);
+        // grow geometrically so adding objects does not reallocate every frame
+        if ((GLsizei)staging.size() > Capacity)
+            Capacity = std::max((GLsizei)staging.size(), Capacity * 2);
+
+        // orphan the old storage so the driver does not wait for last frame's draws
+        glBufferData(GL_ARRAY_BUFFER, Capacity * sizeof(InstanceData), NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, staging.data());
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+};
+#endif
@@ -0,0 +1,181 @@
+#ifndef MESH_REGISTRY_H
+#define MESH_REGISTRY_H
+
+#include <GL/glew.h>
+
+#include <Hash.h>
+
+#include <glm/glm.hpp>
+
+#include <cfloat>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+struct GLMesh
+{
+    GLuint vao;         // Handle for the vertex array object
+    GLuint vbos[4];     // Handles for the vertex buffer objects
+    GLuint nVertices;    // Number of indices of the mesh
+    uint64_t key;       // Geometry hash the registry shares the buffers under
+    GLuint poolMesh;    // Handle of the copy in the geometry pool, 0 when it is not pooled
+    glm::vec3 boundsMin;    // Object space box around the vertex positions
+    glm::vec3 boundsMax;
+};
+
+// Uploads indexed position/UV geometry once per unique set of vertices and indices. Asking for geometry
+// that is already on the GPU returns a handle to the existing VAO and buffers and bumps a reference
+// count; the buffers are freed when the last handle is released.
+class MeshRegistry
+{
+public:
+    // lookup statistics
+    unsigned int Hits;
+    unsigned int Misses;
+
+    MeshRegistry() : Hits(0), Misses(0)
+    {
+    }
+
+    // vertices are interleaved: floatsPerVertex position floats followed by floatsPerUV texture floats
+    GLMesh Acquire(const GLfloat* vertices, size_t vertexCount, const GLushort* indices, size_t indexCount, GLuint floatsPerVertex, GLuint floatsPerUV)
+    {
+        size_t floatCount = vertexCount * (floatsPerVertex + floatsPerUV);
+
+        uint64_t key = HashBytes(vertices, floatCount * sizeof(GLfloat));
+        key = HashBytes(indices, indexCount * sizeof(GLushort), key);
+        key = HashBytes(&floatsPerVertex, sizeof(floatsPerVertex), key);
+        key = HashBytes(&floatsPerUV, sizeof(floatsPerUV), key);
+
+        std::unordered_map<uint64_t, Entry>::iterator it = entries.find(key);
+        if (it != entries.end())
+        {
+            Entry& entry = it->second;
+
+            // the hash only picks the candidate, the data has to match before buffers are shared
+            if (entry.Vertices.size() == floatCount && entry.Indices.size() == indexCount
+                && std::memcmp(entry.Vertices.data(), vertices, floatCount * sizeof(GLfloat)) == 0
+                && std::memcmp(entry.Indices.data(), indices, indexCount * sizeof(GLushort)) == 0)
+            {
+                ++entry.References;
+                ++Hits;
+                return entry.Mesh;
+            }
+
+            // collision: upload a private copy the registry does not track
+            std::cout << "WARNING: mesh hash collision, uploading unshared copy" << std::endl;
+            GLMesh mesh = upload(vertices, floatCount, indices, indexCount, floatsPerVertex, floatsPerUV);
+            mesh.key = 0;
+            ++Misses;
+            return mesh;
+        }
+
+        Entry entry;
+        entry.Mesh = upload(vertices, floatCount, indices, indexCount, floatsPerVertex, floatsPerUV);
+        entry.Mesh.key = key;
+        entry.References = 1;
+        entry.Vertices.assign(vertices, vertices + floatCount);
+        entry.Indices.assign(indices, indices + indexCount);
+        entries[key] = entry;
+
+        ++Misses;
+        return entry.Mesh;
+    }
+
+    // drops one reference, the GPU buffers go away with the last one
+    void Release(GLMesh& mesh)
+    {
+        std::unordered_map<uint64_t, Entry>::iterator it = entries.find(mesh.key);
+        if (it != entries.end() && it->second.Mesh.vao == mesh.vao)
+        {
+            if (--it->second.References == 0)
+            {
+                destroy(it->second.Mesh);
+                entries.erase(it);
+            }
+        }
+        else if (mesh.vao != 0)
+        {
+            destroy(mesh);
+        }
+
+        mesh = GLMesh();
+    }
+
+    // number of distinct meshes currently on the GPU
+    size_t UniqueMeshes() const
+    {
+        return entries.size();
+    }
+
+private:
+    struct Entry
+    {
+        GLMesh Mesh;
+        unsigned int References;
+        std::vector<GLfloat> Vertices;
+        std::vector<GLushort> Indices;
+    };
+
+    std::unordered_map<uint64_t, Entry> entries;
+
+    static GLMesh upload(const GLfloat* vertices, size_t floatCount, const GLushort* indices, size_t indexCount, GLuint floatsPerVertex, GLuint floatsPerUV)
+    {
+        GLMesh mesh = GLMesh();
+
+        glGenVertexArrays(1, &mesh.vao);
+        glBindVertexArray(mesh.vao);
+
+        glGenBuffers(2, mesh.vbos);
+        glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]);
+        glBufferData(GL_ARRAY_BUFFER, floatCount * sizeof(GLfloat), vertices, GL_STATIC_DRAW);
+
+        //Data for the indices
+        mesh.nVertices = (GLuint)indexCount;
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(GLushort), indices, GL_STATIC_DRAW);
+
+        // Strides between vertex coordinates
+        GLint stride = sizeof(float) * (floatsPerVertex + floatsPerUV);
+
+        glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
+        glEnableVertexAttribArray(0);
+
+        glVertexAttribPointer(1, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(float) * floatsPerVertex));
+        glEnableVertexAttribArray(1);
+
+        glBindVertexArray(0);
+
+        computeBounds(mesh, vertices, floatCount, floatsPerVertex, floatsPerUV);
+        return mesh;
+    }
+
+    // Bounding box of the positions, missing coordinates of 2D positions are 0
+    static void computeBounds(GLMesh& mesh, const GLfloat* vertices, size_t floatCount, GLuint floatsPerVertex, GLuint floatsPerUV)
+    {
+        GLuint stride = floatsPerVertex + floatsPerUV;
+        GLuint coordinates = floatsPerVertex < 3 ? floatsPerVertex : 3;
+        if (floatCount < stride)
+            return;
+
+        mesh.boundsMin = glm::vec3(FLT_MAX);
+        mesh.boundsMax = glm::vec3(-FLT_MAX);
+        for (size_t v = 0; v + stride <= floatCount; v += stride)
+        {
+            glm::vec3 position(0.0f);
+            for (GLuint c = 0; c < coordinates; ++c)
+                position[c] = vertices[v + c];
+            mesh.boundsMin = glm::min(mesh.boundsMin, position);
+            mesh.boundsMax = glm::max(mesh.boundsMax, position);
+        }
+    }
+
+    static void destroy(GLMesh& mesh)
+    {
+        glDeleteVertexArrays(1, &mesh.vao);
+        glDeleteBuffers(2, mesh.vbos);
+    }
+};
+#endif
@@ -0,0 +1,221 @@
+#ifndef PIXEL_UPLOAD_RING_H
+#define PIXEL_UPLOAD_RING_H
+
+#include <GL/glew.h>
+
+#include <cstring>
+#include <deque>
+
+// Streams texture uploads through one persistently mapped pixel unpack buffer used as a ring. Pixels are
+// copied into mapped memory and glTexImage2D reads them from the buffer, so the driver does not have to
+// take a synchronous copy of client memory. Every upload is fenced and a region is only overwritten once
+// the GPU has finished reading it.
+class PixelUploadRing
+{
+public:
+    GLuint Buffer;
+    GLsizeiptr Size;
+
+    // statistics
+    unsigned int Uploads;
+    unsigned int DirectUploads; // too large for the ring, or no buffer storage support
+    unsigned int Stalls;        // uploads that had to wait for the GPU to release ring space
+
+    PixelUploadRing() : Buffer(0), Size(0), Uploads(0), DirectUploads(0), Stalls(0), mapped(NULL), head(0)
+    {
+    }
+
+    // needs GL 4.4 or ARB_buffer_storage, otherwise every upload falls back to glTexImage2D from client memory
+    bool Create(GLsizeiptr size)
+    {
+        if (!GLEW_VERSION_4_4 && !GLEW_ARB_buffer_storage)
+            return false;
+
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+        glGenBuffers(1, &Buffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, Buffer);
+        glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, NULL, flags);
+        mapped = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        if (!mapped)
+        {
+            glDeleteBuffers(1, &Buffer);
+            Buffer = 0;
+            return false;
+        }
+
+        Size = size;
+        head = 0;
+        return true;
+    }
+
+    void Destroy()
+    {
+        while (!inFlight.empty())
+        {
+            glClientWaitSync(inFlight.front().Fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            glDeleteSync(inFlight.front().Fence);
+            inFlight.pop_front();
+        }
+
+        if (Buffer)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, Buffer);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            glDeleteBuffers(1, &Buffer);
+        }
+
+        Buffer = 0;
+        mapped = NULL;
+        Size = 0;
+    }
+
+    // Specifies one level of the texture bound to GL_TEXTURE_2D. format is GL_RGB or GL_RGBA with one byte
+    // per channel; rows must be tightly packed (GL_UNPACK_ALIGNMENT 1 for RGB).
+    void Upload(GLenum internalFormat, GLsizei width, GLsizei height, GLenum format, const unsigned char* pixels, GLint level = 0)
+    {
+        GLsizeiptr bytes = (GLsizeiptr)width * height * (format == GL_RGB ? 3 : 4);
+
+        if (!mapped || bytes > Size)
+        {
+            glTexImage2D(GL_TEXTURE_2D, level, internalFormat, width, height, 0, format, GL_UNSIGNED_BYTE, pixels);
+            ++DirectUploads;
+            return;
+        }
+
+        GLsizeiptr offset = stage(pixels, bytes);
+        glTexImage2D(GL_TEXTURE_2D, level, internalFormat, width, height, 0, format, GL_UNSIGNED_BYTE, (const void*)offset);
+        fence(offset, bytes);
+    }
+
+    // Specifies one mip level of block-compressed data for the texture bound to GL_TEXTURE_2D
+    void UploadCompressed(GLint level, GLenum format, GLsizei width, GLsizei height, const unsigned char* data, GLsizeiptr bytes)
+    {
+        if (!mapped || bytes > Size)
+        {
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, format, width, height, 0, (GLsizei)bytes, data);
+            ++DirectUploads;
+            return;
+        }
+
+        GLsizeiptr offset = stage(data, bytes);
+        glCompressedTexImage2D(GL_TEXTURE_2D, level, format, width, height, 0, (GLsizei)bytes, (const void*)offset);
+        fence(offset, bytes);
+    }
+
+    // Specifies one layer of one level of the GL_TEXTURE_2D_ARRAY bound, whose storage already exists
+    void UploadLayer(GLint level, GLint layer, GLsizei width, GLsizei height, GLenum format, const unsigned char* pixels)
+    {
+        GLsizeiptr bytes = (GLsizeiptr)width * height * (format == GL_RGB ? 3 : 4);
+
+        if (!mapped || bytes > Size)
+        {
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, 1, format, GL_UNSIGNED_BYTE, pixels);
+            ++DirectUploads;
+            return;
+        }
+
+        GLsizeiptr offset = stage(pixels, bytes);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, 1, format, GL_UNSIGNED_BYTE, (const void*)offset);
+        fence(offset, bytes);
+    }
+
+    void UploadCompressedLayer(GLint level, GLint layer, GLenum format, GLsizei width, GLsizei height, const unsigned char* data, GLsizeiptr bytes)
+    {
+        if (!mapped || bytes > Size)
+        {
+            glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, 1, format, (GLsizei)bytes, data);
+            ++DirectUploads;
+            return;
+        }
+
+        GLsizeiptr offset = stage(data, bytes);
+        glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, 1, format, (GLsizei)bytes, (const void*)offset);
+        fence(offset, bytes);
+    }
+
+private:
+    struct Region
+    {
+        GLsizeiptr Begin;
+        GLsizeiptr End;
+        GLsync Fence;
+    };
+
+    unsigned char* mapped;
+    GLsizeiptr head;
+    std::deque<Region> inFlight;
+
+    // copies data into the ring and leaves the buffer bound as the unpack source
+    GLsizeiptr stage(const unsigned char* data, GLsizeiptr bytes)
+    {
+        GLsizeiptr offset = allocate(bytes);
+        std::memcpy(mapped + offset, data, (size_t)bytes);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, Buffer);
+        return offset;
+    }
+
+    // unbinds the buffer and fences the region the upload just read from
+    void fence(GLsizeiptr offset, GLsizeiptr bytes)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        Region region;
+        region.Begin = offset;
+        region.End = offset + bytes;
+        region.Fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        inFlight.push_back(region);
+
+        ++Uploads;
+    }
+
+    // reserves bytes at the ring head, waiting for the GPU to finish with any region still in use there
+    GLsizeiptr allocate(GLsizeiptr bytes)
+    {
+        // keep uploads aligned so the copy source offsets stay friendly to the DMA engine
+        const GLsizeiptr alignment = 256;
+        head = (head + alignment - 1) / alignment * alignment;
+        if (head + bytes > Size)
+            head = 0;
+
+        GLsizeiptr begin = head;
+        GLsizeiptr end = head + bytes;
+
+        // fences signal in submission order, so waiting on an overlapping region also retires older ones
+        for (size_t i = 0; i < inFlight.size(); ++i)
+        {
+            if (inFlight[i].Begin < end && begin < inFlight[i].End)
+            {
+                GLenum status = glClientWaitSync(inFlight[i].Fence, 0, 0);
+                if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                {
+                    ++Stalls;
+                    glClientWaitSync(inFlight[i].Fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+                }
+            }
+        }
+
+        retire();
+
+        head = end;
+        return begin;
+    }
+
+    // drops the fences of regions the GPU is done with
+    void retire()
+    {
+        while (!inFlight.empty())
+        {
+            GLenum status = glClientWaitSync(inFlight.front().Fence, 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                break;
+
+            glDeleteSync(inFlight.front().Fence);
+            inFlight.pop_front();
+        }
+    }
+};
+#endif
@@ -0,0 +1,195 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <GL/glew.h>
+
+#include <Hash.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// bump whenever the file layout changes so stale cache files are ignored
+const unsigned int PROGRAM_CACHE_VERSION = 1;
+
+// Stores linked programs in Directory with glGetProgramBinary, one file per program named after the hash of
+// its shader sources and the driver that built it. A hit replaces compiling and linking with glProgramBinary.
+// Drivers may still reject a binary (after an update the version string usually changes, but not always),
+// so Load reports a miss whenever the program does not link and the caller compiles from source instead.
+class ProgramCache
+{
+public:
+    std::string Directory;
+
+    // startup report
+    unsigned int Hits;
+    unsigned int Misses;
+    unsigned int Rejected;
+    double LoadMilliseconds;        // spent in glProgramBinary on hits
+    double CompileMilliseconds;     // spent compiling and linking on misses
+    double SavedMilliseconds;       // compile time recorded when the hits were stored, minus their load time
+
+    ProgramCache() : Directory("./resources/program_cache"), Hits(0), Misses(0), Rejected(0),
+        LoadMilliseconds(0.0), CompileMilliseconds(0.0), SavedMilliseconds(0.0)
+    {
+    }
+
+    // the driver has to offer at least one binary format, some expose the entry points but none
+    static bool Supported()
+    {
+        if (!GLEW_ARB_get_program_binary && !GLEW_VERSION_4_1)
+            return false;
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        return formats > 0;
+    }
+
+    // binaries only load on the driver that produced them
+    static unsigned long long Key(const char* vtxShaderSource, const char* fragShaderSource)
+    {
+        unsigned long long key = HashBytes(vtxShaderSource, std::strlen(vtxShaderSource));
+        key = HashBytes(fragShaderSource, std::strlen(fragShaderSource), key);
+
+        const GLenum strings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+        for (size_t i = 0; i < sizeof(strings) / sizeof(strings[0]); ++i)
+        {
+            const char* value = (const char*)glGetString(strings[i]);
+            if (value)
+                key = HashBytes(value, std::strlen(value), key);
+        }
+        return key;
+    }
+
+    std::string FileName(unsigned long long key) const
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.glb", key);
+        return Directory + "/" + name;
+    }
+
+    // loads the binary into programId, which must be a fresh program object
+    bool Load(unsigned long long key, GLuint programId)
+    {
+        FILE* file = std::fopen(FileName(key).c_str(), "rb");
+        if (!file)
+        {
+            ++Misses;
+            return false;
+        }
+
+        Header header;
+        std::vector<unsigned char> binary;
+        bool ok = std::fread(&header, sizeof(header), 1, file) == 1 &&
+            header.Magic == MAGIC && header.Version == PROGRAM_CACHE_VERSION && header.Key == key && header.Length > 0;
+        if (ok)
+        {
+            binary.resize(header.Length);
+            ok = std::fread(binary.data(), binary.size(), 1, file) == 1;
+        }
+        std::fclose(file);
+
+        if (ok)
+        {
+            glProgramBinary(programId, header.Format, binary.data(), (GLsizei)binary.size());
+            GLint linked = GL_FALSE;
+            glGetProgramiv(programId, GL_LINK_STATUS, &linked);
+            ok = linked == GL_TRUE;
+        }
+
+        if (!ok)
+        {
+            // a corrupt file or a binary the driver no longer accepts is rebuilt and overwritten
+            ++Rejected;
+            ++Misses;
+            return false;
+        }
+
+        ++Hits;
+        SavedMilliseconds += header.CompileMilliseconds;
+        return true;
+    }
+
+    // records the time the hit took, so the report shows what was saved net of loading
+    void AddLoadTime(double milliseconds)
+    {
+        LoadMilliseconds += milliseconds;
+        SavedMilliseconds -= milliseconds;
+    }
+
+    // writes to a temporary name first so a crash or a concurrent reader never sees half a file.
+    // The program must have been linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set.
+    bool Store(unsigned long long key, GLuint programId, double compileMilliseconds)
+    {
+        CompileMilliseconds += compileMilliseconds;
+
+        GLint length = 0;
+        glGetProgramiv(programId, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return false;
+
+        std::vector<unsigned char> binary(length);
+        GLenum format = 0;
+        GLsizei written = 0;
+        glGetProgramBinary(programId, length, &written, &format, binary.data());
+        if (written <= 0)
+            return false;
+
+        makeDirectory();
+        std::string path = FileName(key);
+        std::string temporary = path + ".tmp";
+        FILE* file = std::fopen(temporary.c_str(), "wb");
+        if (!file)
+            return false;
+
+        Header header;
+        header.Magic = MAGIC;
+        header.Version = PROGRAM_CACHE_VERSION;
+        header.Format = format;
+        header.Length = (unsigned int)written;
+        header.Key = key;
+        header.CompileMilliseconds = compileMilliseconds;
+
+        bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+            std::fwrite(binary.data(), written, 1, file) == 1;
+
+        ok = std::fclose(file) == 0 && ok;
+        if (ok)
+        {
+            std::remove(path.c_str());
+            ok = std::rename(temporary.c_str(), path.c_str()) == 0;
+        }
+        if (!ok)
+            std::remove(temporary.c_str());
+        return ok;
+    }
+
+private:
+    static const unsigned int MAGIC = 0x31424c47; // "GLB1"
+
+    struct Header
+    {
+        unsigned int Magic;
+        unsigned int Version;
+        unsigned int Format;
+        unsigned int Length;
+        unsigned long long Key;
+        double CompileMilliseconds;     // how long the program took to build from source
+    };
+
+    void makeDirectory() const
+    {
+#ifdef _WIN32
+        _mkdir(Directory.c_str());
+#else
+        mkdir(Directory.c_str(), 0755);
+#endif
+    }
+};
+#endif
@@ -0,0 +1,316 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <GL/glew.h>
+
+#include <FrameRing.h>
+#include <FrameUniforms.h>
+#include <ShaderProgram.h>
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+// One draw of an indexed mesh. Layer and UVTransform select the texture region the way the scene shaders
+// expect: the atlas layer and its uv scale/offset, or the bindless handle index.
+struct DrawItem
+{
+    ShaderProgram* Program;
+    GLuint Vao;
+    GLsizei IndexCount;
+    GLenum IndexType;
+    GLenum TextureTarget;
+    GLuint Texture;         // bound to unit 0, 0 leaves the current binding alone
+    glm::mat4 Model;
+    float Layer;
+    glm::vec4 UVTransform;
+};
+
+// GL state changes made by one Flush, and the ones a naive submission in scene order would have made
+struct RenderQueueStats
+{
+    unsigned int Draws;
+    unsigned int ProgramChanges;
+    unsigned int TextureChanges;
+    unsigned int VaoChanges;
+    unsigned int UnsortedChanges;
+};
+
+// Collects the draws of a frame and submits them sorted by a 64 bit key, so draws sharing a program, a
+// texture and a VAO end up next to each other and each of those is only set when it changes. Within a run
+// of identical state draws go front to back, which lets the depth test reject hidden fragments early.
+//
+//  bits 63..56  program, numbered in the order programs are first seen
+//  bits 55..40  texture name
+//  bits 39..24  vertex array name
+//  bits 23..0   distance to the camera, the top bits of the positive float
+//
+// The per-object data of all draws is written in one go, in draw order, and each draw binds its range of it
+// to the ObjectData block: into the FrameRing when there is one, otherwise into ObjectBuffer.
+class RenderQueue
+{
+public:
+    RenderQueueStats LastFrame;
+    RenderQueueStats Total;
+    unsigned int Frames;
+
+    GLuint ObjectBuffer;
+    FrameRing* Ring;
+
+    RenderQueue() : Frames(0), ObjectBuffer(0), Ring(NULL), objectCapacity(0), objectStride(0), cameraPosition(0.0f)
+    {
+        std::memset(&LastFrame, 0, sizeof(LastFrame));
+        std::memset(&Total, 0, sizeof(Total));
+    }
+
+    void Create()
+    {
+        glGenBuffers(1, &ObjectBuffer);
+
+        // every draw's range has to start at a multiple of the uniform buffer offset alignment
+        GLsizeiptr alignment = FrameRing::OffsetAlignment(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT);
+        objectStride = ((GLsizeiptr)sizeof(DrawData) + alignment - 1) / alignment * alignment;
+    }
+
+    void Destroy()
+    {
+        glDeleteBuffers(1, &ObjectBuffer);
+        ObjectBuffer = 0;
+        objectCapacity = 0;
+    }
+
+    // starts a frame, depths are measured from cameraPosition
+    void Begin(const glm::vec3& camera)
+    {
+        cameraPosition = camera;
+        items.clear();
+        keys.clear();
+    }
+
+    void Submit(const DrawItem& item)
+    {
+        glm::vec3 position(item.Model[3]);
+        float distance = glm::length(position - cameraPosition);
+
+        // positive floats compare like their bit patterns, the top 24 bits keep 15 bits of mantissa
+        uint32_t depthBits;
+        std::memcpy(&depthBits, &distance, sizeof(depthBits));
+
+        SortKey sortKey;
+        sortKey.Key = ((uint64_t)programIndex(item.Program) << 56) |
+            ((uint64_t)(item.Texture & 0xFFFF) << 40) |
+            ((uint64_t)(item.Vao & 0xFFFF) << 24) |
+            (uint64_t)(depthBits >> 8);
+        sortKey.Item = (uint32_t)items.size();
+
+        items.push_back(item);
+        keys.push_back(sortKey);
+    }
+
+    size_t Size() const
+    {
+        return items.size();
+    }
+
+    // sorts and draws everything submitted since Begin
+    void Flush()
+    {
+        std::memset(&LastFrame, 0, sizeof(LastFrame));
+        if (items.empty())
+            return;
+        LastFrame.UnsortedChanges = countChanges();
+
+        RadixSort(keys, scratch);
+
+        GLuint objectSource;
+        GLintptr objectOffset;
+        writeObjects(objectSource, objectOffset);
+
+        // nothing is known about the state left by other code, the first draw sets everything
+        ShaderProgram* program = NULL;
+        GLuint texture = 0;
+        GLuint vao = 0;
+        bool first = true;
+
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            const DrawItem& item = items[keys[i].Item];
+
+            if (first || item.Program != program)
+            {
+                program = item.Program;
+                program->Use();
+                ++LastFrame.ProgramChanges;
+            }
+            if (item.Texture != 0 && (first || item.Texture != texture))
+            {
+                texture = item.Texture;
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(item.TextureTarget, texture);
+                ++LastFrame.TextureChanges;
+            }
+            if (first || item.Vao != vao)
+            {
+                vao = item.Vao;
+                glBindVertexArray(vao);
+                ++LastFrame.VaoChanges;
+            }
+            first = false;
+
+            glBindBufferRange(GL_UNIFORM_BUFFER, OBJECT_DATA_BINDING, objectSource, objectOffset + (GLintptr)i * objectStride, sizeof(DrawData));
+            glDrawElements(GL_TRIANGLES, item.IndexCount, item.IndexType, NULL);
+            ++LastFrame.Draws;
+        }
+
+        ++Frames;
+        Total.Draws += LastFrame.Draws;
+        Total.ProgramChanges += LastFrame.ProgramChanges;
+        Total.TextureChanges += LastFrame.TextureChanges;
+        Total.VaoChanges += LastFrame.VaoChanges;
+        Total.UnsortedChanges += LastFrame.UnsortedChanges;
+
+        items.clear();
+        keys.clear();
+    }
+
+    struct SortKey
+    {
+        uint64_t Key;
+        uint32_t Item;
+    };
+
+    // Least significant digit radix sort on 8 bit digits, stable, so equal keys keep their submission order.
+    // Passes over digits that are the same in every key are skipped, which with few programs, textures and
+    // VAOs leaves mostly the depth bytes.
+    static void RadixSort(std::vector<SortKey>& keys, std::vector<SortKey>& scratch)
+    {
+        size_t count = keys.size();
+        if (count < 2)
+            return;
+
+        // all eight histograms in one pass over the keys
+        uint32_t histograms[8][256];
+        std::memset(histograms, 0, sizeof(histograms));
+        for (size_t i = 0; i < count; ++i)
+        {
+            uint64_t key = keys[i].Key;
+            for (int digit = 0; digit < 8; ++digit)
+                ++histograms[digit][(key >> (digit * 8)) & 0xFF];
+        }
+
+        scratch.resize(count);
+        SortKey* source = keys.data();
+        SortKey* target = scratch.data();
+        for (int digit = 0; digit < 8; ++digit)
+        {
+            uint32_t* histogram = histograms[digit];
+            if (histogram[(keys[0].Key >> (digit * 8)) & 0xFF] == count)
+                continue;
+
+            uint32_t offset = 0;
+            for (int bucket = 0; bucket < 256; ++bucket)
+            {
+                uint32_t size = histogram[bucket];
+                histogram[bucket] = offset;
+                offset += size;
+            }
+
+            for (size_t i = 0; i < count; ++i)
+                target[histogram[(source[i].Key >> (digit * 8)) & 0xFF]++] = source[i];
+
+            SortKey* swap = source;
+            source = target;
+            target = swap;
+        }
+
+        if (source != keys.data())
+            std::memcpy(keys.data(), source, count * sizeof(SortKey));
+    }
+
+private:
+    std::vector<DrawItem> items;
+    std::vector<SortKey> keys;
+    std::vector<SortKey> scratch;
+    std::vector<ShaderProgram*> programs;
+    std::vector<unsigned char> objectStaging;
+    GLsizeiptr objectCapacity;
+    GLsizeiptr objectStride;
+    glm::vec3 cameraPosition;
+
+    // writes the DrawData of every sorted draw, objectStride apart, and returns where they went
+    void writeObjects(GLuint& buffer, GLintptr& offset)
+    {
+        GLsizeiptr bytes = (GLsizeiptr)keys.size() * objectStride;
+
+        RingAllocation space = { NULL, 0, 0 };
+        if (Ring)
+            space = Ring->Allocate(bytes, objectStride);
+
+        unsigned char* target = (unsigned char*)space.Data;
+        if (!target)
+        {
+            objectStaging.resize((size_t)bytes);
+            target = objectStaging.data();
+        }
+
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            const DrawItem& item = items[keys[i].Item];
+            DrawData data;
+            data.Model = item.Model;
+            data.UVTransform = item.UVTransform;
+            data.Layer = item.Layer;
+            data.Padding[0] = data.Padding[1] = data.Padding[2] = 0.0f;
+            std::memcpy(target + i * objectStride, &data, sizeof(DrawData));
+        }
+
+        if (space.Data)
+        {
+            buffer = Ring->Buffer;
+            offset = space.Offset;
+            return;
+        }
+
+        // orphaned every frame so the driver never waits for the previous frame's draws
+        glBindBuffer(GL_UNIFORM_BUFFER, ObjectBuffer);
+        if (bytes > objectCapacity)
+            objectCapacity = std::max(bytes, objectCapacity * 2);
+        glBufferData(GL_UNIFORM_BUFFER, objectCapacity, NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, bytes, target);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+        buffer = ObjectBuffer;
+        offset = 0;
+    }
+
+    // small stable number for the key, programs are few and live for the whole run
+    uint32_t programIndex(ShaderProgram* program)
+    {
+        for (size_t i = 0; i < programs.size(); ++i)
+        {
+            if (programs[i] == program)
+                return (uint32_t)i & 0xFF;
+        }
+        programs.push_back(program);
+        return (uint32_t)(programs.size() - 1) & 0xFF;
+    }
+
+    // state changes of the draws in submission order, for the report
+    unsigned int countChanges() const
+    {
+        unsigned int changes = 0;
+        for (size_t i = 0; i < items.size(); ++i)
+        {
+            const DrawItem& item = items[i];
+            const DrawItem* previous = i > 0 ? &items[i - 1] : NULL;
+            changes += !previous || item.Program != previous->Program ? 1 : 0;
+            changes += item.Texture != 0 && (!previous || item.Texture != previous->Texture) ? 1 : 0;
+            changes += !previous || item.Vao != previous->Vao ? 1 : 0;
+        }
+        return changes;
+    }
+};
+#endif
@@ -0,0 +1,168 @@
+#ifndef SCENE_GRAPH_H
+#define SCENE_GRAPH_H
+
+#include <glm/glm.hpp>
+#include <glm/gtx/transform.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Handle of a scene graph node, stays valid when the nodes are reordered
+typedef uint32_t SceneNodeId;
+
+// Parent/child transforms with cached world matrices. Each node has a local transform relative to its parent
+// and a mesh scale that sizes its own mesh without being passed on to its children, so a child placed on a
+// scaled box is not stretched with it.
+//
+// Nodes live in one flat array ordered by depth, every parent ahead of its children, so Update is a single
+// front to back pass: a node is recomputed when its local transform changed or its parent was recomputed in
+// the same pass, everything else keeps its cached matrices. A frame in which nothing changed costs nothing.
+class SceneGraph
+{
+public:
+    static const SceneNodeId NONE = 0xFFFFFFFF;
+
+    // statistics
+    unsigned int Updates;
+    unsigned int Recomputed;    // world matrices rebuilt over all updates
+
+    SceneGraph() : Updates(0), Recomputed(0), anyDirty(false), reorder(false)
+    {
+    }
+
+    // parent is NONE for a root, otherwise a node added before
+    SceneNodeId Add(SceneNodeId parent, const glm::mat4& local, const glm::vec3& meshScale = glm::vec3(1.0f))
+    {
+        Node node;
+        node.Local = local;
+        node.World = local;
+        node.Model = local;
+        node.MeshScale = meshScale;
+        node.Id = (SceneNodeId)positions.size();
+        node.ParentId = parent;
+        node.Parent = parent == NONE ? NONE : positions[parent];
+        node.Depth = parent == NONE ? 0 : nodes[node.Parent].Depth + 1;
+        node.Dirty = true;
+
+        // appending keeps the depth order unless a shallower level is still growing
+        if (!nodes.empty() && node.Depth < nodes.back().Depth)
+            reorder = true;
+
+        positions.push_back((uint32_t)nodes.size());
+        nodes.push_back(node);
+        anyDirty = true;
+        return node.Id;
+    }
+
+    void SetLocal(SceneNodeId id, const glm::mat4& local)
+    {
+        Node& node = nodes[positions[id]];
+        node.Local = local;
+        node.Dirty = true;
+        anyDirty = true;
+    }
+
+    void SetMeshScale(SceneNodeId id, const glm::vec3& meshScale)
+    {
+        Node& node = nodes[positions[id]];
+        node.MeshScale = meshScale;
+        node.Dirty = true;
+        anyDirty = true;
+    }
+
+    const glm::mat4& Local(SceneNodeId id) const
+    {
+        return nodes[positions[id]].Local;
+    }
+
+    // parent's world transform times the local one, what children are placed relative to
+    const glm::mat4& World(SceneNodeId id) const
+    {
+        return nodes[positions[id]].World;
+    }
+
+    // World with the mesh scale applied, the matrix the node's mesh is drawn with
+    const glm::mat4& Model(SceneNodeId id) const
+    {
+        return nodes[positions[id]].Model;
+    }
+
+    SceneNodeId Parent(SceneNodeId id) const
+    {
+        return nodes[positions[id]].ParentId;
+    }
+
+    // the last Update recomputed the node's matrices
+    bool Moved(SceneNodeId id) const
+    {
+        uint32_t position = positions[id];
+        return position < changed.size() && changed[position];
+    }
+
+    size_t Size() const
+    {
+        return nodes.size();
+    }
+
+    // brings the cached matrices up to date, call once per frame before they are read
+    void Update()
+    {
+        ++Updates;
+        if (reorder)
+            reorderNodes();
+        if (!anyDirty)
+        {
+            changed.clear();
+            return;
+        }
+
+        changed.assign(nodes.size(), 0);
+        for (size_t i = 0; i < nodes.size(); ++i)
+        {
+            Node& node = nodes[i];
+            bool parentChanged = node.Parent != NONE && changed[node.Parent];
+            if (!node.Dirty && !parentChanged)
+                continue;
+
+            node.World = node.Parent == NONE ? node.Local : nodes[node.Parent].World * node.Local;
+            node.Model = node.World * glm::scale(node.MeshScale);
+            node.Dirty = false;
+            changed[i] = 1;
+            ++Recomputed;
+        }
+        anyDirty = false;
+    }
+
+private:
+    struct Node
+    {
+        glm::mat4 Local;
+        glm::mat4 World;
+        glm::mat4 Model;
+        glm::vec3 MeshScale;
+        SceneNodeId Id;
+        SceneNodeId ParentId;
+        uint32_t Parent;        // position of the parent in nodes, NONE for roots
+        uint32_t Depth;
+        bool Dirty;             // the local transform or mesh scale changed since the last Update
+    };
+
+    std::vector<Node> nodes;            // ordered by depth
+    std::vector<uint32_t> positions;    // position in nodes of each id
+    std::vector<unsigned char> changed; // nodes recomputed by the last Update, empty when none was
+    bool anyDirty;
+    bool reorder;
+
+    // restores the depth order, nodes of one depth keep the order they were added in
+    void reorderNodes()
+    {
+        std::stable_sort(nodes.begin(), nodes.end(), [](const Node& a, const Node& b) { return a.Depth < b.Depth; });
+        for (size_t i = 0; i < nodes.size(); ++i)
+            positions[nodes[i].Id] = (uint32_t)i;
+        for (size_t i = 0; i < nodes.size(); ++i)
+            nodes[i].Parent = nodes[i].ParentId == NONE ? NONE : positions[nodes[i].ParentId];
+        reorder = false;
+    }
+};
+#endif
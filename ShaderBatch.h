@@ -0,0 +1,248 @@
+#ifndef SHADER_BATCH_H
+#define SHADER_BATCH_H
+
+#include <GL/glew.h>
+
+#include <ProgramCache.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Builds a set of shader programs together. Submit hands every compile and link to the driver without
+// reading any status back, so with KHR_parallel_shader_compile the driver works on them on its own threads
+// while the caller goes on with other startup work and checks Ready now and then. Finish collects the results
+// and reports errors per program instead of stopping at the first failure.
+// Without the extension the driver compiles on the first status query, so Submit asks for it straight away and
+// Ready is always true.
+class ShaderBatch
+{
+public:
+    struct Program
+    {
+        std::string Name;
+        GLuint Id;
+        bool Linked;
+        bool Cached;            // loaded from the binary cache instead of compiled
+        std::string Errors;     // compile and link logs, empty when the program linked
+        double Milliseconds;    // spent compiling and linking in Submit plus waiting for the driver in Finish
+    };
+
+    // optional, linked programs are stored to it and looked up before compiling
+    ProgramCache* Cache;
+
+    ShaderBatch(ProgramCache* cache = NULL) : Cache(cache)
+    {
+        // let the driver use as many compiler threads as it likes
+        if (Parallel())
+        {
+            if (GLEW_KHR_parallel_shader_compile)
+                glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+            else
+                glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+        }
+    }
+
+    static bool Parallel()
+    {
+        return GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile;
+    }
+
+    // starts building a program and returns its index, the program id is valid straight away
+    size_t Submit(const char* name, const char* vtxShaderSource, const char* fragShaderSource)
+    {
+        Pending pending;
+        pending.Start = now();
+        pending.Complete = false;
+        pending.VertexShader = 0;
+        pending.FragmentShader = 0;
+        pending.CacheKey = 0;
+
+        Program program;
+        program.Name = name;
+        program.Id = glCreateProgram();
+        program.Linked = false;
+        program.Cached = false;
+        program.Milliseconds = 0.0;
+
+        // A program linked by this driver from the same sources on an earlier run skips compiling entirely
+        if (Cache)
+        {
+            pending.CacheKey = ProgramCache::Key(vtxShaderSource, fragShaderSource);
+            if (Cache->Load(pending.CacheKey, program.Id))
+            {
+                program.Linked = true;
+                program.Cached = true;
+                program.Milliseconds = elapsed(pending.Start);
+                pending.Complete = true;
+                Cache->AddLoadTime(program.Milliseconds);
+            }
+        }
+
+        if (!program.Cached)
+        {
+            pending.VertexShader = glCreateShader(GL_VERTEX_SHADER);
+            pending.FragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+            glShaderSource(pending.VertexShader, 1, &vtxShaderSource, NULL);
+            glShaderSource(pending.FragmentShader, 1, &fragShaderSource, NULL);
+            glCompileShader(pending.VertexShader);
+            glCompileShader(pending.FragmentShader);
+
+            // linking is queued behind the compiles, a failed compile shows up as a failed link
+            glAttachShader(program.Id, pending.VertexShader);
+            glAttachShader(program.Id, pending.FragmentShader);
+
+            // the driver only keeps a retrievable binary when asked before linking
+            if (Cache)
+                glProgramParameteri(program.Id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+            glLinkProgram(program.Id);
+
+            // a serial driver does the work on this query, so it is timed here and not across whatever the
+            // caller does before Finish
+            if (!Parallel())
+            {
+                GLint success = 0;
+                glGetProgramiv(program.Id, GL_LINK_STATUS, &success);
+                pending.Complete = true;
+            }
+            program.Milliseconds = elapsed(pending.Start);
+        }
+
+        programs.push_back(program);
+        builds.push_back(pending);
+        return programs.size() - 1;
+    }
+
+    // true once every program has finished building, never blocks
+    bool Ready()
+    {
+        bool ready = true;
+        for (size_t i = 0; i < programs.size(); ++i)
+        {
+            if (builds[i].Complete)
+                continue;
+
+            GLint complete = GL_TRUE;
+            if (Parallel())
+                glGetProgramiv(programs[i].Id, GL_COMPLETION_STATUS_KHR, &complete);
+
+            if (complete == GL_TRUE)
+                builds[i].Complete = true;
+            else
+            {
+                ready = false;
+            }
+        }
+        return ready;
+    }
+
+    // waits for every program, collects the errors and stores new programs in the cache.
+    // Returns the number of programs that failed.
+    size_t Finish()
+    {
+        size_t failed = 0;
+        for (size_t i = 0; i < programs.size(); ++i)
+        {
+            Program& program = programs[i];
+            Pending& pending = builds[i];
+            if (!program.Cached && pending.VertexShader != 0)
+            {
+                appendShaderLog(pending.VertexShader, "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n", program.Errors);
+                appendShaderLog(pending.FragmentShader, "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n", program.Errors);
+
+                // blocks until a program the driver is still building is done, only that wait is added
+                Clock::time_point wait = now();
+                GLint success = 0;
+                glGetProgramiv(program.Id, GL_LINK_STATUS, &success);
+                program.Linked = success == GL_TRUE;
+                if (!pending.Complete)
+                {
+                    pending.Complete = true;
+                    program.Milliseconds += elapsed(wait);
+                }
+
+                if (!program.Linked)
+                    appendLog(program.Id, false, "ERROR::SHADER::PROGRAM::LINKING_FAILED\n", program.Errors);
+                else if (Cache)
+                    Cache->Store(pending.CacheKey, program.Id, program.Milliseconds);
+
+                // the program keeps its code, the shader objects are no longer needed
+                glDetachShader(program.Id, pending.VertexShader);
+                glDetachShader(program.Id, pending.FragmentShader);
+                glDeleteShader(pending.VertexShader);
+                glDeleteShader(pending.FragmentShader);
+                pending.VertexShader = 0;
+                pending.FragmentShader = 0;
+            }
+
+            if (!program.Linked)
+                ++failed;
+        }
+        return failed;
+    }
+
+    const std::vector<Program>& Programs() const
+    {
+        return programs;
+    }
+
+    const Program& operator[](size_t index) const
+    {
+        return programs[index];
+    }
+
+private:
+    typedef std::chrono::high_resolution_clock Clock;
+
+    // build state that is only needed until Finish
+    struct Pending
+    {
+        GLuint VertexShader;
+        GLuint FragmentShader;
+        unsigned long long CacheKey;
+        Clock::time_point Start;
+        bool Complete;
+    };
+
+    std::vector<Program> programs;
+    std::vector<Pending> builds;
+
+    static Clock::time_point now()
+    {
+        return Clock::now();
+    }
+
+    static double elapsed(Clock::time_point start)
+    {
+        std::chrono::duration<double, std::milli> duration = Clock::now() - start;
+        return duration.count();
+    }
+
+    static void appendShaderLog(GLuint shaderId, const char* heading, std::string& errors)
+    {
+        GLint success = 0;
+        glGetShaderiv(shaderId, GL_COMPILE_STATUS, &success);
+        if (!success)
+            appendLog(shaderId, true, heading, errors);
+    }
+
+    static void appendLog(GLuint id, bool shader, const char* heading, std::string& errors)
+    {
+        GLint length = 0;
+        if (shader)
+            glGetShaderiv(id, GL_INFO_LOG_LENGTH, &length);
+        else
+            glGetProgramiv(id, GL_INFO_LOG_LENGTH, &length);
+
+        std::vector<char> log(length > 0 ? length : 1, '\0');
+        if (shader)
+            glGetShaderInfoLog(id, (GLsizei)log.size(), NULL, log.data());
+        else
+            glGetProgramInfoLog(id, (GLsizei)log.size(), NULL, log.data());
+
+        errors += heading;
+        errors += log.data();
+        errors += "\n";
+    }
+};
+#endif
@@ -0,0 +1,222 @@
+#ifndef SHADER_PERMUTATIONS_H
+#define SHADER_PERMUTATIONS_H
+
+#include <GL/glew.h>
+
+#include <FrameUniforms.h>
+#include <ShaderBatch.h>
+#include <ShaderProgram.h>
+#include <ShaderReloader.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Compile time features of the scene shaders. A set of them is a ShaderKey, which fits in a few bits so the
+// render loop can put it into its sort keys.
+enum ShaderFeature
+{
+    SHADER_LIGHTING = 1 << 0,
+    SHADER_INSTANCING = 1 << 1,
+    SHADER_ALPHA_TEST = 1 << 2,
+    SHADER_BINDLESS = 1 << 3,
+    SHADER_MULTI_DRAW = 1 << 4,
+    SHADER_DRAW_PARAMETERS = 1 << 5     // MULTI_DRAW finds its draw by gl_DrawIDARB instead of an attribute
+};
+
+typedef unsigned int ShaderKey;
+
+const unsigned int SHADER_FEATURE_COUNT = 6;
+const unsigned int SHADER_PERMUTATION_COUNT = 1 << SHADER_FEATURE_COUNT;
+
+// the #define lines of a key, in feature order so equal keys give identical sources
+inline std::string ShaderDefines(ShaderKey key)
+{
+    static const char* names[SHADER_FEATURE_COUNT] = { "LIGHTING", "INSTANCING", "ALPHA_TEST", "BINDLESS", "MULTI_DRAW", "DRAW_PARAMETERS" };
+
+    std::string defines;
+    for (unsigned int i = 0; i < SHADER_FEATURE_COUNT; ++i)
+    {
+        if (key & (1u << i))
+            defines += std::string("#define ") + names[i] + "\n";
+    }
+    return defines;
+}
+
+// Builds the variants of one vertex/fragment pair, each with the defines of its key inserted after the
+// #version line, so features cost nothing in the shaders that do not use them. Variants are compiled on their
+// first Get, or ahead of time by submitting them to a ShaderBatch, which also stores them in the binary cache.
+class ShaderPermutations
+{
+public:
+    std::string Name;
+    std::string VertexPath;
+    std::string FragmentPath;
+
+    // optional, variants are stored to the cache and rebuilt by the reloader when the files change
+    ProgramCache* Cache;
+    ShaderReloader* Reloader;
+
+    ShaderPermutations() : Cache(NULL), Reloader(NULL)
+    {
+        for (unsigned int i = 0; i < SHADER_PERMUTATION_COUNT; ++i)
+            failed[i] = false;
+    }
+
+    void Create(const char* name, const std::string& vertexPath, const std::string& fragmentPath)
+    {
+        Name = name;
+        VertexPath = vertexPath;
+        FragmentPath = fragmentPath;
+    }
+
+    // a variant that is already built, NULL otherwise. Never compiles.
+    ShaderProgram* Find(ShaderKey key)
+    {
+        return programs[key].Id != 0 ? &programs[key] : NULL;
+    }
+
+    // the variant for key, compiled on first use. NULL when it does not build, which is reported once.
+    ShaderProgram* Get(ShaderKey key)
+    {
+        if (programs[key].Id != 0)
+            return &programs[key];
+        if (failed[key])
+            return NULL;
+
+        ShaderBatch batch(Cache);
+        if (!Submit(batch, key))
+            return NULL;
+        Finish(batch);
+        return Find(key);
+    }
+
+    // queues a variant into a batch the caller finishes with Finish, false when the files cannot be read
+    bool Submit(ShaderBatch& batch, ShaderKey key)
+    {
+        if (programs[key].Id != 0 || failed[key])
+            return true;
+
+        std::string vertexSource, fragmentSource;
+        if (!LoadShaderSource(VertexPath, vertexSource) || !LoadShaderSource(FragmentPath, fragmentSource))
+        {
+            std::cout << "ERROR: shader files " << VertexPath << ", " << FragmentPath << " could not be read" << std::endl;
+            failed[key] = true;
+            return false;
+        }
+
+        std::string defines = ShaderDefines(key);
+        vertexSource = InjectShaderDefines(vertexSource, defines);
+        fragmentSource = InjectShaderDefines(fragmentSource, defines);
+
+        Pending queued;
+        queued.Batch = &batch;
+        queued.Index = batch.Submit(VariantName(key).c_str(), vertexSource.c_str(), fragmentSource.c_str());
+        queued.Key = key;
+        pending.push_back(queued);
+        return true;
+    }
+
+    // finishes the batch and takes over the variants this object submitted to it.
+    // Returns the number of them that failed, their errors are printed.
+    size_t Finish(ShaderBatch& batch)
+    {
+        batch.Finish();
+
+        size_t failures = 0;
+        for (size_t i = 0; i < pending.size();)
+        {
+            if (pending[i].Batch != &batch)
+            {
+                ++i;
+                continue;
+            }
+
+            const ShaderBatch::Program& program = batch[pending[i].Index];
+            ShaderKey key = pending[i].Key;
+            if (program.Linked)
+            {
+                install(key, program.Id);
+            }
+            else
+            {
+                std::cout << "ERROR: shader program " << program.Name << " failed to build\n" << program.Errors << std::endl;
+                glDeleteProgram(program.Id);
+                failed[key] = true;
+                ++failures;
+            }
+            pending.erase(pending.begin() + i);
+        }
+        return failures;
+    }
+
+    // "scene[LIGHTING|INSTANCING]", just "scene" without features
+    std::string VariantName(ShaderKey key) const
+    {
+        if (key == 0)
+            return Name;
+
+        std::string defines = ShaderDefines(key);
+        std::string features;
+        for (std::string::size_type start = 0; start < defines.size();)
+        {
+            std::string::size_type end = defines.find('\n', start);
+            if (!features.empty())
+                features += "|";
+            features += defines.substr(start + 8, end - start - 8);     // skips "#define "
+            start = end + 1;
+        }
+        return Name + "[" + features + "]";
+    }
+
+    // number of variants built so far
+    unsigned int Built() const
+    {
+        unsigned int built = 0;
+        for (unsigned int i = 0; i < SHADER_PERMUTATION_COUNT; ++i)
+            built += programs[i].Id != 0 ? 1 : 0;
+        return built;
+    }
+
+    void Destroy()
+    {
+        for (unsigned int i = 0; i < SHADER_PERMUTATION_COUNT; ++i)
+        {
+            if (programs[i].Id != 0)
+                glDeleteProgram(programs[i].Id);
+            programs[i] = ShaderProgram();
+            failed[i] = false;
+        }
+        pending.clear();
+    }
+
+private:
+    struct Pending
+    {
+        const ShaderBatch* Batch;
+        size_t Index;
+        ShaderKey Key;
+    };
+
+    // indexed by key, the addresses stay fixed so the reloader can swap programs in place
+    ShaderProgram programs[SHADER_PERMUTATION_COUNT];
+    bool failed[SHADER_PERMUTATION_COUNT];
+    std::vector<Pending> pending;
+
+    void install(ShaderKey key, GLuint programId)
+    {
+        // Every program reads the camera matrices from the shared FrameData block
+        FrameUniformBuffer::AttachProgram(programId);
+
+        ShaderProgram& program = programs[key];
+        program.Reflect(programId);
+
+        // the atlas is always bound to unit 0, bindless variants have no sampler uniform
+        program.SetInt("uTexture", 0);
+
+        if (Reloader)
+            Reloader->Add(VariantName(key).c_str(), VertexPath, FragmentPath, program, ShaderDefines(key));
+        ShaderProgram::InvalidateCurrent();
+    }
+};
+#endif
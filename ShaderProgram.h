@@ -0,0 +1,254 @@
+#ifndef SHADER_PROGRAM_H
+#define SHADER_PROGRAM_H
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Wraps a linked shader program. All active uniforms are looked up once after linking and kept in a
+// table, so the render loop never calls glGetUniformLocation. Every uniform remembers the last value that
+// was sent to the GPU and the upload is skipped when the new value is identical.
+class ShaderProgram
+{
+public:
+    // one entry of the binding table
+    struct Uniform
+    {
+        std::string Name;
+        GLint Location;
+        GLenum Type;
+        GLint Size;                         // array length, 1 for plain uniforms
+        std::vector<unsigned char> Value;   // last value uploaded, empty until the first upload
+    };
+
+    GLuint Id;
+
+    // upload statistics
+    unsigned int Uploads;
+    unsigned int SkippedUploads;
+    unsigned int SkippedBinds;
+
+    ShaderProgram() : Id(0), Uploads(0), SkippedUploads(0), SkippedBinds(0)
+    {
+    }
+
+    // builds the uniform table from the program's active uniforms. Call again after relinking.
+    void Reflect(GLuint programId)
+    {
+        Id = programId;
+        uniforms.clear();
+        slots.clear();
+
+        GLint count = 0;
+        GLint maxLength = 0;
+        glGetProgramiv(programId, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(programId, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+        std::vector<char> nameBuffer(maxLength > 0 ? maxLength : 1);
+        for (GLint i = 0; i < count; ++i)
+        {
+            Uniform uniform;
+            GLsizei length = 0;
+            glGetActiveUniform(programId, (GLuint)i, (GLsizei)nameBuffer.size(), &length, &uniform.Size, &uniform.Type, nameBuffer.data());
+            uniform.Name.assign(nameBuffer.data(), length);
+
+            // members of uniform blocks have no location, they are fed through buffers instead
+            uniform.Location = glGetUniformLocation(programId, uniform.Name.c_str());
+            if (uniform.Location < 0)
+                continue;
+
+            // arrays are reported as "name[0]", register them under "name"
+            std::string::size_type bracket = uniform.Name.find('[');
+            if (bracket != std::string::npos)
+                uniform.Name.erase(bracket);
+
+            slots[uniform.Name] = (int)uniforms.size();
+            uniforms.push_back(uniform);
+        }
+    }
+
+    // switches to a relinked build of the same shaders. Uniforms keep their slots, so slots resolved earlier stay
+    // valid, and the values last uploaded to the old program are uploaded to the new one. Uniforms the new
+    // program no longer has keep their slot with location -1, which GL ignores.
+    void Reload(GLuint programId)
+    {
+        std::vector<Uniform> previous;
+        previous.swap(uniforms);
+        std::unordered_map<std::string, int> previousSlots;
+        previousSlots.swap(slots);
+        bool wasCurrent = CurrentProgram() == Id && Id != 0;
+
+        Reflect(programId);
+
+        std::vector<Uniform> reflected;
+        reflected.swap(uniforms);
+        uniforms = previous;
+        slots = previousSlots;
+        for (size_t i = 0; i < uniforms.size(); ++i)
+            uniforms[i].Location = -1;
+
+        for (size_t i = 0; i < reflected.size(); ++i)
+        {
+            std::unordered_map<std::string, int>::const_iterator it = slots.find(reflected[i].Name);
+            if (it == slots.end())
+            {
+                slots[reflected[i].Name] = (int)uniforms.size();
+                uniforms.push_back(reflected[i]);
+                continue;
+            }
+
+            Uniform& uniform = uniforms[it->second];
+            bool sameType = uniform.Type == reflected[i].Type && uniform.Size == reflected[i].Size;
+            uniform.Location = reflected[i].Location;
+            uniform.Type = reflected[i].Type;
+            uniform.Size = reflected[i].Size;
+            if (sameType)
+                upload(uniform);
+            else
+                uniform.Value.clear();
+        }
+
+        // the old program is about to be deleted, make sure the next Use binds the new one
+        if (wasCurrent)
+            InvalidateCurrent();
+    }
+
+    // binds the program, skipping the call when it is already current
+    void Use()
+    {
+        if (CurrentProgram() == Id)
+        {
+            ++SkippedBinds;
+            return;
+        }
+        glUseProgram(Id);
+        CurrentProgram() = Id;
+    }
+
+    // resolves a uniform name to a slot in the table, -1 if the uniform is not active.
+    // Resolve slots once at startup and pass them to the Set functions in the render loop.
+    int Slot(const char* name) const
+    {
+        std::unordered_map<std::string, int>::const_iterator it = slots.find(name);
+        return it == slots.end() ? -1 : it->second;
+    }
+
+    const std::vector<Uniform>& Uniforms() const
+    {
+        return uniforms;
+    }
+
+    void SetInt(int slot, int value)
+    {
+        if (changed(slot, &value, sizeof(value)))
+            glProgramUniform1i(Id, uniforms[slot].Location, value);
+    }
+
+    void SetFloat(int slot, float value)
+    {
+        if (changed(slot, &value, sizeof(value)))
+            glProgramUniform1f(Id, uniforms[slot].Location, value);
+    }
+
+    void SetVec3(int slot, const glm::vec3& value)
+    {
+        if (changed(slot, glm::value_ptr(value), sizeof(value)))
+            glProgramUniform3fv(Id, uniforms[slot].Location, 1, glm::value_ptr(value));
+    }
+
+    void SetVec4(int slot, const glm::vec4& value)
+    {
+        if (changed(slot, glm::value_ptr(value), sizeof(value)))
+            glProgramUniform4fv(Id, uniforms[slot].Location, 1, glm::value_ptr(value));
+    }
+
+    void SetMat4(int slot, const glm::mat4& value)
+    {
+        if (changed(slot, glm::value_ptr(value), sizeof(value)))
+            glProgramUniformMatrix4fv(Id, uniforms[slot].Location, 1, GL_FALSE, glm::value_ptr(value));
+    }
+
+    // name based setters for one-off setup code, not meant for the render loop
+    void SetInt(const char* name, int value) { SetInt(Slot(name), value); }
+    void SetFloat(const char* name, float value) { SetFloat(Slot(name), value); }
+    void SetVec3(const char* name, const glm::vec3& value) { SetVec3(Slot(name), value); }
+    void SetVec4(const char* name, const glm::vec4& value) { SetVec4(Slot(name), value); }
+    void SetMat4(const char* name, const glm::mat4& value) { SetMat4(Slot(name), value); }
+
+    void ResetStats()
+    {
+        Uploads = 0;
+        SkippedUploads = 0;
+        SkippedBinds = 0;
+    }
+
+    // forgets which program is bound, call when something outside the wrappers calls glUseProgram
+    static void InvalidateCurrent()
+    {
+        CurrentProgram() = 0;
+    }
+
+private:
+    std::vector<Uniform> uniforms;
+    std::unordered_map<std::string, int> slots;
+
+    static GLuint& CurrentProgram()
+    {
+        static GLuint current = 0;
+        return current;
+    }
+
+    // sends the cached value of a uniform again, used after relinking
+    void upload(const Uniform& uniform)
+    {
+        if (uniform.Value.empty() || uniform.Location < 0)
+            return;
+
+        const void* value = uniform.Value.data();
+        switch (uniform.Type)
+        {
+        case GL_FLOAT:
+            glProgramUniform1fv(Id, uniform.Location, 1, (const GLfloat*)value);
+            break;
+        case GL_FLOAT_VEC3:
+            glProgramUniform3fv(Id, uniform.Location, 1, (const GLfloat*)value);
+            break;
+        case GL_FLOAT_VEC4:
+            glProgramUniform4fv(Id, uniform.Location, 1, (const GLfloat*)value);
+            break;
+        case GL_FLOAT_MAT4:
+            glProgramUniformMatrix4fv(Id, uniform.Location, 1, GL_FALSE, (const GLfloat*)value);
+            break;
+        default:
+            // ints, bools and samplers, the only other types the setters write
+            glProgramUniform1iv(Id, uniform.Location, 1, (const GLint*)value);
+            break;
+        }
+        ++Uploads;
+    }
+
+    // compares against the cached value and stores the new one, returns false when the upload can be skipped
+    bool changed(int slot, const void* data, size_t bytes)
+    {
+        if (slot < 0 || slot >= (int)uniforms.size())
+            return false;
+
+        std::vector<unsigned char>& cached = uniforms[slot].Value;
+        if (cached.size() == bytes && std::memcmp(cached.data(), data, bytes) == 0)
+        {
+            ++SkippedUploads;
+            return false;
+        }
+
+        cached.assign((const unsigned char*)data, (const unsigned char*)data + bytes);
+        ++Uploads;
+        return true;
+    }
+};
+#endif
@@ -0,0 +1,192 @@
+#ifndef SHADER_RELOADER_H
+#define SHADER_RELOADER_H
+
+#include <GL/glew.h>
+
+#include <FileWatcher.h>
+#include <FrameUniforms.h>
+#include <ShaderBatch.h>
+#include <ShaderProgram.h>
+
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// reads a whole shader file, false when it cannot be opened
+inline bool LoadShaderSource(const std::string& path, std::string& source)
+{
+    std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+    if (!file)
+        return false;
+
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    source = contents.str();
+    return true;
+}
+
+// Inserts preprocessor lines right after the #version line, which has to stay first. A #line directive
+// follows them so compile errors still point at the right line of the file.
+inline std::string InjectShaderDefines(const std::string& source, const std::string& defines)
+{
+    if (defines.empty())
+        return source;
+
+    std::string::size_type versionEnd = 0;
+    if (source.compare(0, 8, "#version") == 0)
+    {
+        versionEnd = source.find('\n');
+        versionEnd = versionEnd == std::string::npos ? source.size() : versionEnd + 1;
+    }
+
+    std::string result = source.substr(0, versionEnd);
+    if (versionEnd > 0 && result[result.size() - 1] != '\n')
+        result += '\n';
+    result += defines;
+    result += versionEnd > 0 ? "#line 2\n" : "#line 1\n";
+    result += source.substr(versionEnd);
+    return result;
+}
+
+// Rebuilds programs whose shader files change while the application runs. Update runs once per frame: it
+// submits the affected programs to a ShaderBatch, so the driver compiles them in the background, and swaps
+// each one in with ShaderProgram::Reload once it linked. A program that fails to build is reported and
+// deleted, and the previous one stays in use, so a typo in a shader never takes the scene down.
+class ShaderReloader
+{
+public:
+    // optional, rebuilt programs are stored to it like the ones built at startup
+    ProgramCache* Cache;
+
+    // statistics
+    unsigned int Reloads;
+    unsigned int Failures;
+
+    ShaderReloader() : Cache(NULL), Reloads(0), Failures(0)
+    {
+    }
+
+    // program must already be built from these files, with defines injected into both sources
+    void Add(const char* name, const std::string& vertexPath, const std::string& fragmentPath, ShaderProgram& program, const std::string& defines = std::string())
+    {
+        Entry entry;
+        entry.Name = name;
+        entry.VertexPath = vertexPath;
+        entry.FragmentPath = fragmentPath;
+        entry.Defines = defines;
+        entry.Program = &program;
+        entry.Dirty = false;
+        entries.push_back(entry);
+
+        watcher.Watch(vertexPath);
+        watcher.Watch(fragmentPath);
+    }
+
+    void Update()
+    {
+        std::vector<std::string> changed = watcher.Poll();
+        for (size_t i = 0; i < changed.size(); ++i)
+        {
+            for (size_t e = 0; e < entries.size(); ++e)
+            {
+                if (entries[e].VertexPath == changed[i] || entries[e].FragmentPath == changed[i])
+                    entries[e].Dirty = true;
+            }
+        }
+
+        // one rebuild at a time, files saved meanwhile are picked up by the next one
+        if (batch)
+        {
+            if (!batch->Ready())
+                return;
+            finish();
+        }
+
+        for (size_t e = 0; e < entries.size(); ++e)
+        {
+            Entry& entry = entries[e];
+            if (!entry.Dirty)
+                continue;
+            entry.Dirty = false;
+
+            std::string vertexSource, fragmentSource;
+            if (!LoadShaderSource(entry.VertexPath, vertexSource) || !LoadShaderSource(entry.FragmentPath, fragmentSource))
+            {
+                // a half-written save, the next write marks the entry again
+                continue;
+            }
+
+            vertexSource = InjectShaderDefines(vertexSource, entry.Defines);
+            fragmentSource = InjectShaderDefines(fragmentSource, entry.Defines);
+            if (!batch)
+                batch.reset(new ShaderBatch(Cache));
+            batch->Submit(entry.Name.c_str(), vertexSource.c_str(), fragmentSource.c_str());
+            building.push_back(e);
+        }
+    }
+
+    const FileWatcher& Watcher() const
+    {
+        return watcher;
+    }
+
+    // deletes a rebuild that is still in flight, the programs in use belong to the caller
+    void Stop()
+    {
+        if (batch)
+        {
+            batch->Finish();
+            for (size_t i = 0; i < batch->Programs().size(); ++i)
+                glDeleteProgram((*batch)[i].Id);
+            batch.reset();
+        }
+        building.clear();
+        watcher.Stop();
+    }
+
+private:
+    struct Entry
+    {
+        std::string Name;
+        std::string VertexPath;
+        std::string FragmentPath;
+        std::string Defines;
+        ShaderProgram* Program;
+        bool Dirty;     // a file changed since the program was last submitted
+    };
+
+    std::vector<Entry> entries;
+    FileWatcher watcher;
+    std::unique_ptr<ShaderBatch> batch;
+    std::vector<size_t> building;   // entry of each program in the batch
+
+    void finish()
+    {
+        batch->Finish();
+        for (size_t i = 0; i < building.size(); ++i)
+        {
+            const ShaderBatch::Program& program = (*batch)[i];
+            Entry& entry = entries[building[i]];
+            if (!program.Linked)
+            {
+                std::cout << "ERROR: shader program " << entry.Name << " failed to reload, keeping the previous one\n" << program.Errors << std::endl;
+                glDeleteProgram(program.Id);
+                ++Failures;
+                continue;
+            }
+
+            FrameUniformBuffer::AttachProgram(program.Id);
+            GLuint previous = entry.Program->Id;
+            entry.Program->Reload(program.Id);
+            glDeleteProgram(previous);
+            ++Reloads;
+            std::cout << "INFO: Reloaded shader program " << entry.Name << " in " << program.Milliseconds << " ms" << std::endl;
+        }
+        batch.reset();
+        building.clear();
+    }
+};
+#endif
@@ -4,6 +4,30 @@
 #include <GLFW/glfw3.h>     // GLFW library
 #include <cmath>
 #include <Camera.h>
+#include <ShaderProgram.h>
+#include <FrameRing.h>
+#include <FrameUniforms.h>
+#include <InstanceBatch.h>
+#include <MeshRegistry.h>
+#include <MeshOptimizer.h>
+#include <TextureManager.h>
+#include <TextureLoader.h>
+#include <TextureCompressor.h>
+#include <MipChain.h>
+#include <PixelUploadRing.h>
+#include <TextureAtlas.h>
+#include <BindlessTextures.h>
+#include <ProgramCache.h>
+#include <ShaderBatch.h>
+#include <ShaderReloader.h>
+#include <ShaderPermutations.h>
+#include <RenderQueue.h>
+#include <SceneGraph.h>
+#include <TransformKernels.h>
+#include <EntityRegistry.h>
+#include <GeometryPool.h>
+#include <BoundingVolumeHierarchy.h>
+#include <FrustumCulling.h>
 
 //Texture Loading utility functions
 #define STB_IMAGE_IMPLEMENTATION
@@ -14,11 +38,9 @@
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
-/*Shader program Macro*/
-#ifndef GLSL
-#define GLSL(Version, Source) "#version " #Version " core \n" #Source
-#endif
 #include <vector>
+#include <cstring>
+#include <unordered_map>
 
 
 namespace {
@@ -37,12 +59,25 @@ namespace {
 
     std::vector<each_pole> each_pole_vector; // vector of structs
 
-    struct GLMesh
-    {
-        GLuint vao;         // Handle for the vertex array object
-        GLuint vbos[4];     // Handles for the vertex buffer objects
-        GLuint nVertices;    // Number of indices of the mesh
-    };
+    // Uploads each unique piece of geometry once and shares it between meshes
+    MeshRegistry gMeshRegistry;
+
+    // Shares textures loaded from the same path or with the same pixels
+    TextureManager gTextureManager;
+
+    // Decodes textures on worker threads, the GL thread only uploads
+    TextureLoader gTextureLoader;
+    const int MAX_TEXTURE_UPLOADS_PER_FRAME = 4;
+
+    // Persistently mapped staging memory for asynchronous texture uploads
+    PixelUploadRing gPixelUploadRing;
+    const GLsizeiptr PIXEL_UPLOAD_RING_SIZE = 64 * 1024 * 1024;
+
+    // Variables holding a placeholder texture, updated if the decoded pixels match an existing texture
+    std::unordered_map<GLuint, std::vector<GLuint*> > gPendingTextureUsers;
+    double gTextureLoadStart = 0.0;
+    bool gTexturesReady = false;
+
     //Camera Position
     Camera gCamera(glm::vec3(0.0f, 0.0f, 3.0f));
     
@@ -66,10 +101,86 @@ namespace {
 
     //Plane Mesh Data
     GLMesh plane;
+
+    // Pole mesh, generated from the steps/radius parameters
+    GLMesh cylinder;
     // 
-    // Shader program
-    GLuint gProgramId;
-    GLuint gProgramId2;
+    // Shader program variants, built from one source pair with the enabled features defined.
+    // gShader and gInstancedShader are the variants in use this frame.
+    ShaderPermutations gScenePermutations;
+    ShaderKey gSceneFeatures = 0;
+    ShaderKey gStartupFeatures = 0;
+    ShaderProgram* gShader = NULL;
+
+    // Draws that are not instanced are collected here and submitted sorted by program, texture and mesh
+    RenderQueue gRenderQueue;
+
+    // Per-frame camera data shared by all shader programs
+    FrameUniformBuffer gFrameUniforms;
+
+    // Triple-buffered mapped memory for everything written once per frame: camera data, per-object data,
+    // instance attributes and indirect commands. --no-frame-ring streams them through their own buffers.
+    FrameRing gFrameRing;
+    const GLsizeiptr FRAME_RING_SECTION_SIZE = 16 * 1024 * 1024;
+
+    // Instanced cube drawing, every cube shares one VAO and is drawn from the instance buffer
+    bool gInstancedDraw = true;
+    ShaderProgram* gInstancedShader = NULL;
+    InstanceBatch gCubeBatch;
+
+    // Multi-draw: every mesh is suballocated from one pool and the frame is one glMultiDrawElementsIndirect
+    bool gMultiDraw = false;
+    ShaderProgram* gMultiDrawShader = NULL;
+    GeometryPool gGeometryPool;
+    MultiDrawBatch gMultiDrawBatch;
+
+    // Object transforms, built once by UCreateSceneGraph. The prongs are children of the charger body and the
+    // eraser head of the eraser body, each object's own size is its node's mesh scale.
+    SceneGraph gSceneGraph;
+    SceneNodeId gChargerNode;
+    SceneNodeId gProngOneNode;
+    SceneNodeId gProngTwoNode;
+    SceneNodeId gEraserBodyNode;
+    SceneNodeId gEraserHeadNode;
+    SceneNodeId gPlaneNode;
+
+    // Extra boxes requested with --boxes N to measure how the scene scales, one entity each
+    EntityRegistry gEntities;
+
+    // Objects of the scene, registered with the culler by UCollectSceneObjects and kept across frames, only
+    // the ones in view are drawn. --no-culling draws them all.
+    struct SceneObject
+    {
+        const GLMesh* Mesh;
+        const GLuint* Texture;      // follows the texture variable when a load resolves it to a shared texture
+        SceneNodeId Node;           // scene graph node placing the object, NONE for entities
+        const glm::mat4* Model;     // world matrix of an entity, owned by the registry
+    };
+    std::vector<SceneObject> gSceneObjects;
+    size_t gFirstEntityObject = 0;
+    // set whenever objects are added to or removed from the scene, their matrices may have moved in memory
+    bool gSceneObjectsChanged = true;
+    FrustumCuller gCuller;
+
+    // --bvh culls large scenes (--boxes) through a hierarchy over the objects' world boxes, refit as they
+    // move. It is faster while the scene stands still and slower while many objects move, so every box is
+    // tested by default.
+    BoundingVolumeHierarchy gSceneBvh;
+
+    // Every texture of the scene, bound once per frame
+    TextureAtlas gTextureAtlas;
+
+    // --bindless: textures stay separate and resident, draws index a handle table instead of the atlas
+    bool gBindless = false;
+    BindlessTextureTable gBindlessTextures;
+
+    // Linked programs are kept on disk as driver binaries, --no-program-cache always compiles from source
+    ProgramCache gProgramCache;
+    bool gUseProgramCache = false;
+
+    // Shader sources are read from files and rebuilt while the application runs whenever they are saved
+    const std::string SHADER_DIRECTORY = "./resources/shaders/";
+    ShaderReloader gShaderReloader;
 
     //Texture Ids
     GLuint gPlugBodyId;
@@ -85,66 +196,162 @@ bool UInitialize(int, char* [], GLFWwindow** window);
 void UResizeWindow(GLFWwindow* window, int width, int height);
 void UProcessInput(GLFWwindow* window);
 void URender();
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId);
-void UDestroyShaderProgram(GLuint programId);
 void UCreateCube(GLMesh& mesh);
+void UCreateCylinder(GLMesh& mesh);
+void UCreateOptimizedMesh(GLMesh& mesh, std::vector<GLfloat>& vertices, std::vector<unsigned int>& indices, GLuint floatsPerVertex, GLuint floatsPerUV, const char* name);
+void UDrawCube(const GLMesh& mesh, GLuint textureId, const glm::mat4& model);
+void UCollectSceneObjects();
+void UAddObject(const GLMesh& mesh, const GLuint& textureId, const glm::mat4& model, SceneNodeId node);
+void UDrawVisibleObjects();
 void UCreatePlane(GLMesh& mesh);
 void UCreatePlugBody(GLMesh& mesh);
 void UDestroyMesh(GLMesh& mesh);
+void UCreateSceneGraph();
+void UCreateBoxEntities(int count);
 void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos);
 void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset);
 void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
 bool UCreateTexture(const char* filename, GLuint& textureId);
+GLuint UCreatePlaceholderTexture();
+void UPumpTextureUploads(int maxUploads);
+void UDestroyTexture(GLuint textureId);
+bool URunBenchmarks(int argc, char* argv[]);
+void UUploadTexture(DecodedImage& image);
+void USelectSceneShaders();
+bool USupportedShaderKey(ShaderKey key);
+ShaderKey UMultiDrawFeatures();
+AtlasRegion UTextureRegion(GLuint textureId);
 
 
 
-/* Vertex Shader Source Code*/
-const GLchar* vertexShaderSource = GLSL(440,
-    layout(location = 0) in vec3 position; // Vertex data from Vertex Attrib Pointer 0
-layout(location = 1) in vec2 textureCoordinate;  // Texture data from Vertex Attrib Pointer 2
+int main(int argc, char* argv[]) {
 
-out vec2 vertexTextureCoordinate; // variable to transfer color data to the fragment shader
+    // Headless benchmarks run without opening a window
+    if (URunBenchmarks(argc, argv))
+        return EXIT_SUCCESS;
 
-uniform mat4 shaderTransform; // 4x4 matrix variable for transforming vertex data
-// Global Variables for transform matricies
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+    if (!UInitialize(argc, argv, &gWindow))
+        return EXIT_FAILURE;
+    std::cout << "Initialized" << std::endl;
 
-void main()
-{
-    gl_Position = projection * view * model * vec4(position, 1.0f); // transforms vertices to clip coordinates
-    vertexTextureCoordinate = textureCoordinate; // references incoming color data
-}
-);
+    // Textures are block-compressed and cached on disk when the GL can sample S3TC
+    gTextureLoader.Compress = GLEW_EXT_texture_compression_s3tc != 0;
 
+    // --stb-flip lets stb_image flip rows during loading instead of the row swap afterwards
+    // --no-texture-compression uploads uncompressed RGB/RGBA as before
+    // --mip-kaiser builds the mip chains with the Kaiser filter instead of the box filter
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--stb-flip") == 0)
+            gTextureLoader.FlipOnLoad = true;
+        else if (std::strcmp(argv[i], "--no-texture-compression") == 0)
+            gTextureLoader.Compress = false;
+        else if (std::strcmp(argv[i], "--mip-kaiser") == 0)
+            gTextureLoader.Filter = MIP_FILTER_KAISER;
+    }
 
+    // Start the decode threads first so images decode while the rest of the scene is set up
+    gTextureLoader.Start();
+    gTextureLoadStart = glfwGetTime();
 
-/* Fragment Shader Source Code*/
-const GLchar* fragmentShaderSource = GLSL(440,
-    in vec2 vertexTextureCoordinate; // Variable to hold incoming color data from vertex shader
+    if (!gPixelUploadRing.Create(PIXEL_UPLOAD_RING_SIZE))
+        std::cout << "INFO: Persistent buffer mapping unavailable, textures upload from client memory" << std::endl;
 
-out vec4 fragmentColor;
+    // Textures are drawn from the atlas, which holds a grey placeholder until every texture has loaded,
+    // or with --bindless from a table of resident handles when the driver supports it
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--bindless") == 0)
+            gBindless = true;
+    }
+    if (gBindless && !BindlessTextureTable::Supported())
+    {
+        std::cout << "INFO: ARB_bindless_texture unavailable, using the texture atlas" << std::endl;
+        gBindless = false;
+    }
 
-uniform sampler2D uTexture;
+    if (gBindless)
+        gBindlessTextures.Create();
+    else
+        gTextureAtlas.Create();
+    // One source pair for every variant of the scene shaders
+    gScenePermutations.Create("scene", SHADER_DIRECTORY + "scene.vert", SHADER_DIRECTORY + "scene.frag");
+
+    // --alpha-test discards transparent texels, for textures with cut-outs
+    // --precompile-shaders builds every variant at startup instead of on first use, filling the binary cache
+    bool precompileShaders = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--alpha-test") == 0)
+            gSceneFeatures |= SHADER_ALPHA_TEST;
+        else if (std::strcmp(argv[i], "--precompile-shaders") == 0)
+            precompileShaders = true;
+    }
+    if (gBindless)
+        gSceneFeatures |= SHADER_BINDLESS;
+    gStartupFeatures = gSceneFeatures;
 
-void main()
-{
-    fragmentColor = texture(uTexture, vertexTextureCoordinate);
-}
-);
+    // Create the per-frame uniform buffer before any program so they can all be attached to it
+    gFrameUniforms.Create();
+    gRenderQueue.Create();
 
-int main(int argc, char* argv[]) {
+    // Meshes are copied into the pool as they are created
+    gGeometryPool.Create();
+    gMultiDrawBatch.Create();
 
+    bool useFrameRing = true;
+    bool useSceneBvh = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--no-frame-ring") == 0)
+            useFrameRing = false;
+        if (std::strcmp(argv[i], "--no-culling") == 0)
+            gCuller.Enabled = false;
+        if (std::strcmp(argv[i], "--bvh") == 0)
+            useSceneBvh = true;
+    }
+    if (useSceneBvh)
+        gCuller.Hierarchy = &gSceneBvh;
+    if (useFrameRing && gFrameRing.Create(FRAME_RING_SECTION_SIZE))
+    {
+        gFrameUniforms.Ring = &gFrameRing;
+        gRenderQueue.Ring = &gFrameRing;
+        gCubeBatch.Ring = &gFrameRing;
+        gMultiDrawBatch.Ring = &gFrameRing;
+    }
+    else if (useFrameRing)
+    {
+        std::cout << "INFO: Persistent mapping unavailable, per-frame data is streamed with glBufferData" << std::endl;
+    }
 
-    if (!UInitialize(argc, argv, &gWindow))
-        return EXIT_FAILURE;
-    std::cout << "Initialized" << std::endl;
+    gUseProgramCache = ProgramCache::Supported();
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--no-program-cache") == 0)
+            gUseProgramCache = false;
+    }
 
+    // The variants go to the driver now and compile on its threads while the meshes and textures are set up.
+    // Saving a shader file rebuilds the variants built from it in the background.
+    gScenePermutations.Cache = gUseProgramCache ? &gProgramCache : NULL;
+    gScenePermutations.Reloader = &gShaderReloader;
+    gShaderReloader.Cache = gScenePermutations.Cache;
+
+    ShaderBatch shaderBatch(gScenePermutations.Cache);
+    for (ShaderKey key = 0; key < SHADER_PERMUTATION_COUNT; ++key)
+    {
+        bool required = key == gSceneFeatures || key == (gSceneFeatures | SHADER_INSTANCING);
+        bool optional = precompileShaders && USupportedShaderKey(key);
+        if ((required || optional) && !gScenePermutations.Submit(shaderBatch, key) && required)
+            return EXIT_FAILURE;
+    }
 
     UCreateCube(chargerCube);
     std::cout << "Plug BodyMesh Created" << std::endl;
 
+    // All cubes share the same geometry, so the instanced batch reads the first cube's buffers
+    gCubeBatch.Create(chargerCube.vbos[0], chargerCube.vbos[1], chargerCube.nVertices);
+
     // Load texture(relative to project's directory)
     const char* plugBody = "./resources/textures/WhitePlastic.png";
     if (!UCreateTexture(plugBody, gPlugBodyId))
@@ -153,12 +360,6 @@ int main(int argc, char* argv[]) {
         return EXIT_FAILURE;
     }
 
-    // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-    glUseProgram(gProgramId);
-
-    // We set the texture as texture unit 
-    glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
-
     //-----------------------------------------------------------------------------
 
     //Create Prong One and Texture
@@ -173,9 +374,6 @@ int main(int argc, char* argv[]) {
         return EXIT_FAILURE;
     }
 
-    // We set the texture as texture unit 
-    glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
-
     //-----------------------------------------------------------------------------
 
     UCreateCube(cubeProngTwo);
@@ -188,9 +386,6 @@ int main(int argc, char* argv[]) {
         return EXIT_FAILURE;
     }
 
-    // We set the texture as texture unit
-    glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
-
     
     //-----------------------------------------------------------------------------
 
@@ -199,16 +394,13 @@ int main(int argc, char* argv[]) {
 
 
     // Load texture(relative to project's directory)
-    const char* eraserHead = "./resources/textures/Eraser.png";
-    if (!UCreateTexture(eraserHead, gEraserHead))
+    const char* eraserHeadTex = "./resources/textures/Eraser.png";
+    if (!UCreateTexture(eraserHeadTex, gEraserHead))
     {
-        std::cout << "Failed to load texture " << eraserHead << std::endl;
+        std::cout << "Failed to load texture " << eraserHeadTex << std::endl;
         return EXIT_FAILURE;
     }
 
-    // We set the texture as texture unit 2
-    glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
-
     
     //-----------------------------------------------------------------------------
     
@@ -217,22 +409,24 @@ int main(int argc, char* argv[]) {
 
 
     // Load texture(relative to project's directory)
-    const char* eraserBody = "./resources/textures/EraserBody.png";
-    if (!UCreateTexture(eraserBody, gEraserBody))
+    const char* eraserBodyTex = "./resources/textures/EraserBody.png";
+    if (!UCreateTexture(eraserBodyTex, gEraserBody))
     {
-        std::cout << "Failed to load texture " << eraserBody << std::endl;
+        std::cout << "Failed to load texture " << eraserBodyTex << std::endl;
         return EXIT_FAILURE;
     }
 
-    // We set the texture as texture unit 2
-    glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
-
 
     //-----------------------------------------------------------------------------
 
     UCreateCube(plane);
     std::cout << "Plane mesh Created" << std::endl;
 
+    UCreateCylinder(cylinder);
+    std::cout << "Cylinder mesh Created" << std::endl;
+
+    UCreateSceneGraph();
+
 
     // Load texture(relative to project's directory)
     const char* planeTex = "./resources/textures/CuttingMat.png";
@@ -242,14 +436,40 @@ int main(int argc, char* argv[]) {
         return EXIT_FAILURE;
     }
 
-    // We set the texture as texture unit 2
-    glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
+    // --boxes N adds N boxes to the scene to stress test drawing
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--boxes") == 0)
+        {
+            int boxes = std::atoi(argv[i + 1]);
+            UCreateBoxEntities(boxes);
+            std::cout << "Stress test: " << boxes << " extra boxes" << std::endl;
+        }
+    }
 
     //-----------------------------------------------------------------------------
 
-    // Create the shader program
-    if (!UCreateShaderProgram(vertexShaderSource, fragmentShaderSource, gProgramId))
+    // Waits only for the programs the driver has not finished yet
+    bool shadersReady = shaderBatch.Ready();
+    gScenePermutations.Finish(shaderBatch);
+    if (!gScenePermutations.Find(gSceneFeatures) || !gScenePermutations.Find(gSceneFeatures | SHADER_INSTANCING))
         return EXIT_FAILURE;
+    std::cout << "INFO: Shader programs " << (shadersReady ? "compiled during" : "still compiling after") << " scene setup ("
+        << (ShaderBatch::Parallel() ? "parallel" : "serial") << " compile):";
+    for (size_t i = 0; i < shaderBatch.Programs().size(); ++i)
+        std::cout << " " << shaderBatch[i].Name << " " << shaderBatch[i].Milliseconds << " ms" << (shaderBatch[i].Cached ? " (cached)" : "");
+    std::cout << std::endl;
+    std::cout << "INFO: Watching shaders in " << SHADER_DIRECTORY << (gShaderReloader.Watcher().UsesInotify() ? " with inotify" : " by polling") << std::endl;
+
+    if (gUseProgramCache)
+        std::cout << "INFO: Shader programs from the binary cache: " << gProgramCache.Hits << " (" << gProgramCache.LoadMilliseconds << " ms), compiled: "
+            << gProgramCache.Misses << " (" << gProgramCache.CompileMilliseconds << " ms, rejected binaries: " << gProgramCache.Rejected
+            << "), compile time saved: " << gProgramCache.SavedMilliseconds << " ms" << std::endl;
+    else
+        std::cout << "INFO: Program binaries unavailable, shaders compiled from source" << std::endl;
+
+    std::cout << "INFO: Unique meshes on the GPU: " << gMeshRegistry.UniqueMeshes() << " (registry hits: "
+        << gMeshRegistry.Hits << ", misses: " << gMeshRegistry.Misses << "), in the geometry pool: " << gGeometryPool.Meshes() << std::endl;
 
     //Set background to black
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
@@ -264,21 +484,136 @@ int main(int argc, char* argv[]) {
         gDeltaTime = currentFrame - gLastFrame;
         gLastFrame = currentFrame;
 
+        // Uploads textures that finished decoding since the last frame
+        UPumpTextureUploads(MAX_TEXTURE_UPLOADS_PER_FRAME);
+
+        // Swaps in shader programs that were edited and finished rebuilding
+        gShaderReloader.Update();
+
         URender();
 
 
         glfwPollEvents();
     }
 
+    gTextureLoader.Stop();
+    gShaderReloader.Stop();
+
+    std::cout << "INFO: Texture uploads through the staging ring: " << gPixelUploadRing.Uploads << ", direct: "
+        << gPixelUploadRing.DirectUploads << ", stalls: " << gPixelUploadRing.Stalls << std::endl;
+    gPixelUploadRing.Destroy();
+
     UDestroyMesh(chargerCube);
     UDestroyMesh(cubeProngOne);
     UDestroyMesh(cubeProngTwo);
+    UDestroyMesh(eraserHead);
+    UDestroyMesh(eraserBody);
     UDestroyMesh(plane);
-    UDestroyShaderProgram(gProgramId);
+    UDestroyMesh(cylinder);
+    gBindlessTextures.Destroy();
+    UDestroyTexture(gPlugBodyId);
+    UDestroyTexture(gPlugProngOneId);
+    UDestroyTexture(gPlugProngTwoId);
+    UDestroyTexture(gEraserHead);
+    UDestroyTexture(gEraserBody);
+    UDestroyTexture(gPlane);
+    gScenePermutations.Destroy();
+    gCubeBatch.Destroy();
+    gMultiDrawBatch.Destroy();
+    gGeometryPool.Destroy();
+    if (!gBindless)
+        gTextureAtlas.Destroy();
+    gRenderQueue.Destroy();
+    gFrameUniforms.Destroy();
+
+    if (gFrameRing.Frames > 0)
+    {
+        std::cout << "INFO: Frame ring: " << gFrameRing.Frames << " frames, peak " << gFrameRing.PeakBytes / 1024 << " of "
+            << gFrameRing.SectionSize / 1024 << " KB per frame, " << gFrameRing.Overflows.load() << " overflows, "
+            << gFrameRing.Stalls << " stalls waiting " << gFrameRing.StallMilliseconds << " ms for the GPU" << std::endl;
+    }
+    gFrameRing.Destroy();
+
+    if (gShader)
+        std::cout << "INFO: Uniform uploads: " << gShader->Uploads << ", skipped: " << gShader->SkippedUploads
+            << ", skipped program binds: " << gShader->SkippedBinds << std::endl;
+    if (gRenderQueue.Frames > 0)
+    {
+        const RenderQueueStats& total = gRenderQueue.Total;
+        double frames = gRenderQueue.Frames;
+        std::cout << "INFO: Render queue per frame: " << total.Draws / frames << " draws, " << total.ProgramChanges / frames << " program, "
+            << total.TextureChanges / frames << " texture and " << total.VaoChanges / frames << " VAO changes ("
+            << total.UnsortedChanges / frames << " changes in scene order)" << std::endl;
+    }
+    if (gCuller.Frames > 0)
+    {
+        double frames = gCuller.Frames;
+        std::cout << "INFO: Frustum culling per frame: " << gCuller.TotalTested / frames << " objects tested, " << gCuller.TotalCulled / frames
+            << " culled, " << gCuller.TotalMoved / frames << " moved" << std::endl;
+    }
+    if (gSceneBvh.Builds > 0)
+        std::cout << "INFO: Scene BVH: " << gSceneBvh.Size() << " objects in " << gSceneBvh.NodeCount() << " nodes, " << gSceneBvh.Builds
+            << " builds, " << gSceneBvh.Refits << " refits, " << gSceneBvh.NodesVisited << " nodes visited" << std::endl;
+    std::cout << "INFO: Scene graph: " << gSceneGraph.Size() << " nodes, " << gSceneGraph.Recomputed << " world matrices computed in "
+        << gSceneGraph.Updates << " updates" << std::endl;
+    std::cout << "INFO: Shader variants built: " << gScenePermutations.Built() << " of " << SHADER_PERMUTATION_COUNT << std::endl;
     exit(EXIT_SUCCESS);
 
 }
 
+// Runs the benchmarks named on the command line, returns false when none was requested
+bool URunBenchmarks(int argc, char* argv[])
+{
+    bool ran = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--bench-flip") == 0)
+        {
+            // an optional image file follows the flag
+            bool hasFile = i + 1 < argc && std::strncmp(argv[i + 1], "--", 2) != 0;
+            BenchmarkImageFlip(hasFile ? argv[i + 1] : NULL);
+            ran = true;
+        }
+        else if (std::strcmp(argv[i], "--bench-compress") == 0)
+        {
+            bool hasFile = i + 1 < argc && std::strncmp(argv[i + 1], "--", 2) != 0;
+            BenchmarkTextureCompression(hasFile ? argv[i + 1] : NULL);
+            ran = true;
+        }
+        else if (std::strcmp(argv[i], "--bench-mesh") == 0)
+        {
+            BenchmarkMeshOptimizer();
+            ran = true;
+        }
+        else if (std::strcmp(argv[i], "--bench-mips") == 0)
+        {
+            BenchmarkMipChain();
+            ran = true;
+        }
+        else if (std::strcmp(argv[i], "--bench-ecs") == 0)
+        {
+            BenchmarkEntities();
+            ran = true;
+        }
+        else if (std::strcmp(argv[i], "--bench-trs") == 0)
+        {
+            BenchmarkTransformKernels();
+            ran = true;
+        }
+        else if (std::strcmp(argv[i], "--bench-cull") == 0)
+        {
+            BenchmarkFrustumCulling();
+            ran = true;
+        }
+        else if (std::strcmp(argv[i], "--bench-bvh") == 0)
+        {
+            BenchmarkBoundingVolumeHierarchy();
+            ran = true;
+        }
+    }
+    return ran;
+}
+
 bool UInitialize(int argc, char* argv[], GLFWwindow** window) {
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
@@ -324,63 +659,184 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window) {
     return true;
 }
 
-// Images are loaded with Y axis going down, but OpenGL's Y axis goes up, so let's flip it
-void flipImageVertically(unsigned char* image, int width, int height, int channels)
+bool UCreateTexture(const char* filename, GLuint& textureId)
 {
-    for (int j = 0; j < height / 2; ++j)
+    // A texture already loaded from this path is shared without decoding the file again
+    if (gTextureManager.FindPath(filename, textureId))
     {
-        int index1 = j * width * channels;
-        int index2 = (height - 1 - j) * width * channels;
+        // still decoding: this variable has to follow the texture if it resolves to a shared one
+        std::unordered_map<GLuint, std::vector<GLuint*> >::iterator pending = gPendingTextureUsers.find(textureId);
+        if (pending != gPendingTextureUsers.end())
+            pending->second.push_back(&textureId);
+        return true;
+    }
 
-        for (int i = width * channels; i > 0; --i)
-        {
-            unsigned char tmp = image[index1];
-            image[index1] = image[index2];
-            image[index2] = tmp;
-            ++index1;
-            ++index2;
-        }
+    // Only the header is read here, so missing or unsupported files still fail straight away
+    int width, height, channels;
+    if (!stbi_info(filename, &width, &height, &channels))
+        return false;
+
+    if (channels != 3 && channels != 4)
+    {
+        std::cout << "Not implemented to handle image with " << channels << " channels" << std::endl;
+        return false;
     }
+
+    // The placeholder's name identifies the texture in the atlas once the worker threads have decoded it
+    textureId = UCreatePlaceholderTexture();
+    gTextureManager.Add(filename, textureId);
+    gPendingTextureUsers[textureId].push_back(&textureId);
+    gTextureLoader.Request(filename, textureId);
+
+    return true;
 }
 
-bool UCreateTexture(const char* filename, GLuint& textureId)
+
+// Creates a 1x1 grey texture with the scene's sampling parameters
+GLuint UCreatePlaceholderTexture()
 {
-    int width, height, channels;
-    unsigned char* image = stbi_load(filename, &width, &height, &channels, 0);
-    if (image)
+    const unsigned char grey[] = { 128, 128, 128, 255 };
+
+    GLuint textureId;
+    glGenTextures(1, &textureId);
+    glBindTexture(GL_TEXTURE_2D, textureId);
+
+    // set the texture wrapping parameters
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    // set texture filtering parameters. The mip chain uploaded with the pixels is sampled trilinearly,
+    // and the filter is set here because bindless handles freeze it when they are created.
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    // a single 1x1 level is already a complete mip chain
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    return textureId;
+}
+
+
+// Collects images the loader threads have finished decoding, at most maxUploads per call so a frame
+// never stalls on a large batch of textures
+void UPumpTextureUploads(int maxUploads)
+{
+    DecodedImage image;
+    for (int uploads = 0; uploads < maxUploads && gTextureLoader.PopDecoded(image); ++uploads)
     {
-        flipImageVertically(image, width, height, channels);
+        std::vector<GLuint*> users;
+        std::unordered_map<GLuint, std::vector<GLuint*> >::iterator pending = gPendingTextureUsers.find(image.TextureId);
+        if (pending != gPendingTextureUsers.end())
+        {
+            users.swap(pending->second);
+            gPendingTextureUsers.erase(pending);
+        }
 
-        glGenTextures(1, &textureId);
-        glBindTexture(GL_TEXTURE_2D, textureId);
+        if (!image.Pixels && image.Compressed.Levels.empty())
+        {
+            std::cout << "Failed to load texture " << image.Path << std::endl;
+            continue;
+        }
 
-        // set the texture wrapping parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        // set texture filtering parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        // A different file with the same pixels is already on the GPU: switch every user over to it
+        GLuint sharedId;
+        if (gTextureManager.ResolveContent(image.TextureId, image.ContentHash, sharedId))
+        {
+            for (size_t i = 0; i < users.size(); ++i)
+                *users[i] = sharedId;
+            TextureLoader::Free(image);
+            continue;
+        }
 
-        if (channels == 3)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-        else if (channels == 4)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
+        if (gBindless)
+        {
+            // Handles freeze the texture, so it is made resident only once its pixels are in
+            UUploadTexture(image);
+            gBindlessTextures.Add(image.TextureId);
+        }
         else
         {
-            std::cout << "Not implemented to handle image with " << channels << " channels" << std::endl;
-            return false;
+            // The atlas keeps the levels until every texture is in and it can lay them out
+            gTextureAtlas.Add(image.TextureId, image);
         }
+        TextureLoader::Free(image);
+    }
 
-        glGenerateMipmap(GL_TEXTURE_2D);
+    // Builds the atlas once every texture has arrived and reports how long it took
+    if (!gTexturesReady && gTextureLoader.Pending() == 0)
+    {
+        gTexturesReady = true;
+        if (gBindless)
+            std::cout << "INFO: Resident bindless textures: " << gBindlessTextures.Size() << std::endl;
+        else if (gTextureAtlas.Build(gPixelUploadRing))
+            std::cout << "INFO: Texture atlas: " << gTextureAtlas.Layers << " layer(s) of " << gTextureAtlas.LayerWidth << "x"
+                << gTextureAtlas.LayerHeight << ", " << gTextureAtlas.Levels << " level(s), " << (gTextureAtlas.Packed ? "packed" : "one texture per layer") << std::endl;
+        std::cout << "INFO: All textures loaded " << (glfwGetTime() - gTextureLoadStart) * 1000.0 << " ms after the first request" << std::endl;
+        std::cout << "INFO: Unique textures on the GPU: " << gTextureManager.UniqueTextures() << " (path hits: "
+            << gTextureManager.PathHits << ", content hits: " << gTextureManager.ContentHits << ", misses: "
+            << gTextureManager.Misses << ")" << std::endl;
+        if (gTextureLoader.Compress)
+            std::cout << "INFO: Compressed texture cache hits: " << gTextureLoader.CacheHits << ", misses: " << gTextureLoader.CacheMisses << std::endl;
+    }
+}
 
-        stbi_image_free(image);
-        glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
 
-        return true;
+// Uploads a decoded image with its mip chain into its own GL_TEXTURE_2D
+void UUploadTexture(DecodedImage& image)
+{
+    glBindTexture(GL_TEXTURE_2D, image.TextureId);
+
+    if (!image.Compressed.Levels.empty())
+    {
+        // The whole mip chain was built and compressed on the CPU, the GPU samples the blocks directly
+        const std::vector<CompressedLevel>& levels = image.Compressed.Levels;
+        for (size_t level = 0; level < levels.size(); ++level)
+            gPixelUploadRing.UploadCompressed((GLint)level, image.Compressed.Format, levels[level].Width, levels[level].Height, levels[level].Data.data(), (GLsizeiptr)levels[level].Data.size());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)levels.size() - 1);
+    }
+    else
+    {
+        // rows of RGB images are not padded to four bytes
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+        // Copies the pixels into mapped staging memory, the GPU pulls them from there asynchronously.
+        // The mip chain was filtered in linear light on the CPU, so glGenerateMipmap is not needed.
+        GLenum format = image.Channels == 3 ? GL_RGB : GL_RGBA;
+        gPixelUploadRing.Upload(format, image.Width, image.Height, format, image.Pixels);
+        for (size_t level = 0; level < image.Mips.size(); ++level)
+            gPixelUploadRing.Upload(format, image.Mips[level].Width, image.Mips[level].Height, format, image.Mips[level].Pixels.data(), (GLint)level + 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)image.Mips.size());
     }
 
-    // Error loading the image
-    return false;
+    // samples the uploaded levels, before a bindless handle can freeze the sampler state
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+    glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
+}
+
+
+// Where a texture is sampled from: its atlas layer and uv transform, or its bindless handle index
+AtlasRegion UTextureRegion(GLuint textureId)
+{
+    AtlasRegion region;
+    if (gBindless)
+    {
+        region.Layer = (float)gBindlessTextures.Find(textureId);
+        region.Transform = glm::vec4(1.0f, 1.0f, 0.0f, 0.0f);
+    }
+    else
+    {
+        gTextureAtlas.Find(textureId, region);
+    }
+    return region;
+}
+
+
+// Releases one user of a texture, the GL texture is deleted once nothing shares it
+void UDestroyTexture(GLuint textureId)
+{
+    gTextureManager.Release(textureId);
 }
 
 // glfw: Whenever the mouse moves, this callback is called.
@@ -487,6 +943,41 @@ void UProcessInput(GLFWwindow* window)
     
     if (glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS)
             projectionOrtho = false;
+
+    // I draws all cubes with instancing, M with one multi-draw, U goes back to one draw call per cube
+    if (glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS)
+    {
+        gInstancedDraw = true;
+        gMultiDraw = false;
+    }
+
+    // gl_DrawIDARB is uniform within each draw of the multi-draw, the draw index attribute is not and
+    // needs non-uniform bindless handles
+    if (glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS && !gMultiDraw)
+    {
+        if (gBindless && !MultiDrawBatch::DrawParameters() && !BindlessTextureTable::NonUniformHandles())
+        {
+            std::cout << "INFO: Multi-draw with bindless textures needs ARB_shader_draw_parameters or NV_gpu_shader5" << std::endl;
+        }
+        else
+        {
+            gInstancedDraw = false;
+            gMultiDraw = true;
+        }
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_U) == GLFW_PRESS)
+    {
+        gInstancedDraw = false;
+        gMultiDraw = false;
+    }
+
+    // L switches to the lit shader variants, K back to the unlit ones
+    if (glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS)
+        gSceneFeatures |= SHADER_LIGHTING;
+
+    if (glfwGetKey(window, GLFW_KEY_K) == GLFW_PRESS)
+        gSceneFeatures &= ~SHADER_LIGHTING;
     
 }
 
@@ -518,236 +1009,263 @@ void URender() {
 
     }
 
-    // 1. Scales the shape by 2
-    glm::mat4 scale = glm::scale(glm::vec3(1.0f, 1.2f, 1.0f));
-
-    // 2. Rotates shape by 45 degrees on the x, y and z axis
-    glm::mat4 rotation = glm::rotate(0.0f, glm::vec3(0.0f, 1.0f, 0.2f));
-   
-
-    // 3. Places object at the origin
-    glm::mat4 translation = glm::translate(glm::vec3(0.0f, -1.0f, 0.0f));
-
-    // Transformations are applied right-to-left order
-    glm::mat4 model = translation * rotation * scale;
-
-    //Set the shader to be used
-    glUseProgram(gProgramId);
-
-    // Retrieves and passes transform matrices to the shader program
-    GLint modelLoc = glGetUniformLocation(gProgramId, "model");
-    GLint viewLoc = glGetUniformLocation(gProgramId, "view");
-    GLint projLoc = glGetUniformLocation(gProgramId, "projection");
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-    
-    //activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(chargerCube.vao);
-
-    //Bind textures to corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gPlugBodyId);
-    
-    glDrawElements(GL_TRIANGLES, chargerCube.nVertices, GL_UNSIGNED_SHORT, NULL); // Draws the triangle
-
-    // Draws the second cube
-    //
-    //
-    //
-    //
-    // 1. Scales the shape by 2
-    scale = glm::scale(glm::vec3(0.3f, 0.8f, 0.05f));
-
-    // 2. Rotates shape by 45 degrees on the x, y and z axis
-    rotation = glm::rotate(0.0f, glm::vec3(0.0f, 1.3f, 0.2f));
+    // Brings the world matrices of moved nodes up to date, a static scene skips the pass
+    gSceneGraph.Update();
 
-    // 3. Places plug spoke at right location
-    translation = glm::translate(glm::vec3(0.35f, 0.1f, -0.75f));
+    // Takes the ring section of the frame that was submitted three frames ago
+    gFrameRing.BeginFrame();
 
-    // Transformations are applied right-to-left order
-    model = rotation * translation * scale;
+    // Writes the camera matrices once, every program reads them from the FrameData block
+    gFrameUniforms.Update(view, projection, gCamera.Position, (float)glfwGetTime());
 
-    //Set the shader to be used
-    glUseProgram(gProgramId);
-
-    // Retrieves and passes transform matrices to the shader program
-    
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    // Objects pick their region of the atlas, which the draws bind, or their bindless handle
+    if (gBindless)
+        gBindlessTextures.Bind();
 
-    //activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(cubeProngOne.vao);
+    // Picks the shader variants for this frame, the draws below are collected and submitted at the end
+    USelectSceneShaders();
+    gRenderQueue.Begin(gCamera.Position);
 
-    //Bind textures to corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gPlugProngOneId);
-    
-    glDrawElements(GL_TRIANGLES, cubeProngOne.nVertices, GL_UNSIGNED_SHORT, NULL); // Draws the triangle
-
-
-    // Draws the third cube
-    //
-    //
-    //
-    
-    // 1. Shrinks the shape
-    scale = glm::scale(glm::vec3(0.3f, 0.8f, 0.05f));
+    // Optional stress-test boxes scattered over the plane, their matrices are only rebuilt after they move
+    bool entitiesMoved = gEntities.Transforms.Changed;
+    UpdateWorldMatrices(gEntities.Transforms);
 
-    // 2. Rotates shape 
-    rotation = glm::rotate(0.0f, glm::vec3(0.0f, 1.0f, 0.2f));
-
-    // 3. Places plug spoke at right location
-    translation = glm::translate(glm::vec3(0.35f, 0.1f, -0.2f));
-
-    // Transformations are applied right-to-left order
-    model = rotation * translation * scale;
-
-    //Set the shader to be used
-    glUseProgram(gProgramId);
-
-    // Retrieves and passes transform matrices to the shader program
-    
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-    //activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(cubeProngTwo.vao);
+    // The culler keeps the objects' boxes, only the ones whose matrices changed are updated
+    if (gSceneObjectsChanged)
+    {
+        UCollectSceneObjects();
+    }
+    else
+    {
+        for (size_t i = 0; i < gFirstEntityObject; ++i)
+        {
+            if (gSceneGraph.Moved(gSceneObjects[i].Node))
+                gCuller.Move(i, gSceneGraph.Model(gSceneObjects[i].Node));
+        }
+        if (entitiesMoved)
+        {
+            for (size_t i = gFirstEntityObject; i < gSceneObjects.size(); ++i)
+                gCuller.Move(i, *gSceneObjects[i].Model);
+        }
+    }
 
-    //Bind textures to corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gPlugProngTwoId);
+    // Culls the objects out of view, the rest are drawn or queued
+    gCuller.SetView(projection * view);
+    gCuller.Cull();
+    UDrawVisibleObjects();
 
-    // Draws the prong
-    glDrawElements(GL_TRIANGLES, cubeProngOne.nVertices, GL_UNSIGNED_SHORT, NULL); // Draws the triangle
+    // Draws the queued cubes with as few program, texture and VAO changes as possible
+    gRenderQueue.Flush();
 
+    // Submits every pooled cube with one indirect multi-draw
+    if (gMultiDraw)
+    {
+        gMultiDrawShader->Use();
+        if (!gBindless)
+        {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, gTextureAtlas.Texture);
+        }
+        gMultiDrawBatch.Draw(gGeometryPool);
+        gMultiDrawBatch.Clear();
+    }
 
-    //
-    //
-    //
-    //
-    //
-    // Draws the Eraser head
-    //
-    //
-    //
+    // Submits every queued cube in a single instanced call
+    if (gInstancedDraw)
+    {
+        gInstancedShader->Use();
+        if (gBindless)
+            gCubeBatch.DrawBindless(BindlessTextureTable::NonUniformHandles());
+        else
+            gCubeBatch.Draw(gTextureAtlas.Texture);
+        gCubeBatch.Clear();
+    }
 
-    // 1. Shrinks the shape
-    scale = glm::scale(glm::vec3(1.0f, 0.9f, 0.55f));
+    glBindVertexArray(0);
 
-    // 2. Rotates shape 
-    rotation = glm::rotate(15.0f, glm::vec3(4.0f, 7.0f, -7.0f));
+    // Every draw reading this frame's ring section was submitted
+    gFrameRing.EndFrame();
 
-    // 3. Places plug spoke at right location
-    translation = glm::translate(glm::vec3(-3.5f, -1.5f, 1.1f));
+    glfwSwapBuffers(gWindow);
 
-    // Transformations are applied right-to-left order
-    model = rotation * translation * scale;
 
-    //Set the shader to be used
-    glUseProgram(gProgramId);
+}
 
-    // Retrieves and passes transform matrices to the shader program
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
 
-    //activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(cubeProngTwo.vao);
 
-    //Bind textures to corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gEraserHead);
+// Picks the scene shader variants for the enabled features, compiling them on first use
+void USelectSceneShaders()
+{
+    ShaderProgram* shader = gScenePermutations.Get(gSceneFeatures);
+    ShaderProgram* instancedShader = gScenePermutations.Get(gSceneFeatures | SHADER_INSTANCING);
+    if (!shader || !instancedShader)
+    {
+        // a variant that does not build falls back to the ones built at startup
+        gSceneFeatures = gStartupFeatures;
+        shader = gScenePermutations.Find(gSceneFeatures);
+        instancedShader = gScenePermutations.Find(gSceneFeatures | SHADER_INSTANCING);
+    }
+    gShader = shader;
+    gInstancedShader = instancedShader;
 
-    // Draws the triangle
-    glDrawElements(GL_TRIANGLES, eraserHead.nVertices, GL_UNSIGNED_SHORT, NULL); // Draws the triangle
+    if (gMultiDraw)
+    {
+        gMultiDrawShader = gScenePermutations.Get(gSceneFeatures | UMultiDrawFeatures());
+        if (!gMultiDrawShader)
+        {
+            std::cout << "INFO: Multi-draw shader unavailable, drawing one call per cube" << std::endl;
+            gMultiDraw = false;
+        }
+    }
+}
 
 
-    // Draws the Eraser Body
-    //
-    //
-    //
+// The multi-draw variant finds its draw data by gl_DrawIDARB where the driver has it
+ShaderKey UMultiDrawFeatures()
+{
+    return SHADER_MULTI_DRAW | (MultiDrawBatch::DrawParameters() ? SHADER_DRAW_PARAMETERS : 0);
+}
 
-    // 1. Shrinks the shape
-    scale = glm::scale(glm::vec3(1.0f, -2.5f, 0.55f));
 
-    // 2. Rotates shape 
-    rotation = glm::rotate(15.0f, glm::vec3(4.0f, 7.0f, -7.0f));
+// Whether a shader variant can be built and used on this driver
+bool USupportedShaderKey(ShaderKey key)
+{
+    // bindless variants only compile where the extension is supported
+    if ((key & SHADER_BINDLESS) && !gBindless)
+        return false;
 
-    // 3. Places plug spoke at right location
-    translation = glm::translate(glm::vec3(-3.5f, -1.5f, 1.1f));
+    // a draw is either instanced or part of a multi-draw
+    if ((key & SHADER_MULTI_DRAW) && (key & SHADER_INSTANCING))
+        return false;
 
-    // Transformations are applied right-to-left order
-    model = rotation * translation * scale;
+    if ((key & SHADER_DRAW_PARAMETERS) && (key & SHADER_MULTI_DRAW) == 0)
+        return false;
+    return (key & SHADER_MULTI_DRAW) == 0 || (key & SHADER_DRAW_PARAMETERS) == (UMultiDrawFeatures() & SHADER_DRAW_PARAMETERS);
+}
 
-    //Set the shader to be used
-    glUseProgram(gProgramId);
 
-    // Retrieves and passes transform matrices to the shader program
+// Draws one cube, or queues it into the instanced batch when instanced drawing is enabled
+void UDrawCube(const GLMesh& mesh, GLuint textureId, const glm::mat4& model)
+{
+    AtlasRegion region = UTextureRegion(textureId);
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    if (gMultiDraw && mesh.poolMesh != 0)
+    {
+        gMultiDrawBatch.Add(gGeometryPool.Mesh(mesh.poolMesh), model, region.Layer, region.Transform);
+        return;
+    }
 
-    //activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(eraserBody.vao);
+    if (gInstancedDraw)
+    {
+        gCubeBatch.Add(model, textureId, region.Layer, region.Transform);
+        return;
+    }
 
-    //Bind textures to corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gEraserBody);
+    // The queue passes the model matrix and where to sample the texture to the shader program
+    DrawItem item;
+    item.Program = gShader;
+    item.Vao = mesh.vao;
+    item.IndexCount = mesh.nVertices;
+    item.IndexType = GL_UNSIGNED_SHORT;
+    item.TextureTarget = GL_TEXTURE_2D_ARRAY;
+    item.Texture = gBindless ? 0 : gTextureAtlas.Texture;
+    item.Model = model;
+    item.Layer = region.Layer;
+    item.UVTransform = region.Transform;
+    gRenderQueue.Submit(item);
+}
 
-    // Draws the triangle
-    glDrawElements(GL_TRIANGLES, eraserBody.nVertices, GL_UNSIGNED_SHORT, NULL); // Draws the triangle
 
+// Registers every object of the scene with the culler, again whenever objects were added or removed
+void UCollectSceneObjects()
+{
+    gSceneObjects.clear();
+    gCuller.Clear();
 
-    // Draws the Plane
-    //
-    //
-    //
+    // The charger and the prongs attached to it
+    UAddObject(chargerCube, gPlugBodyId, gSceneGraph.Model(gChargerNode), gChargerNode);
+    UAddObject(cubeProngOne, gPlugProngOneId, gSceneGraph.Model(gProngOneNode), gProngOneNode);
+    UAddObject(cubeProngTwo, gPlugProngTwoId, gSceneGraph.Model(gProngTwoNode), gProngTwoNode);
 
-    // 1. Scales the shape
-    scale = glm::scale(glm::vec3(20.0f, 20.0f, 0.1f));
+    // The eraser body and its head
+    UAddObject(eraserHead, gEraserHead, gSceneGraph.Model(gEraserHeadNode), gEraserHeadNode);
+    UAddObject(eraserBody, gEraserBody, gSceneGraph.Model(gEraserBodyNode), gEraserBodyNode);
 
-    // 2. Rotates shape 
-    rotation = glm::rotate(90.0f, glm::vec3(-0.5f, 0.5f, 0.5f));
+    // The plane
+    UAddObject(plane, gPlane, gSceneGraph.Model(gPlaneNode), gPlaneNode);
 
-    // 3. Places object in place
-    translation = glm::translate(glm::vec3(-10.0f, -10.0f, -1.0f));
+    // Optional stress-test boxes
+    gFirstEntityObject = gSceneObjects.size();
+    ForEachRenderable(gEntities, [](const GLMesh& mesh, const GLuint& texture, const glm::mat4& world) { UAddObject(mesh, texture, world, SceneGraph::NONE); });
 
-    // Transformations are applied right-to-left order
-    model = rotation * translation * scale;
+    gSceneObjectsChanged = false;
+}
 
-    //Set the shader to be used
-    glUseProgram(gProgramId);
 
-    // Retrieves and passes transform matrices to the shader program
+// Adds an object to the culler, UDrawVisibleObjects draws it in the frames it is in view
+void UAddObject(const GLMesh& mesh, const GLuint& textureId, const glm::mat4& model, SceneNodeId node)
+{
+    SceneObject object = { &mesh, &textureId, node, &model };
+    gSceneObjects.push_back(object);
+    gCuller.Add(mesh.boundsMin, mesh.boundsMax, model);
+}
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
 
-    //activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(plane.vao);
+void UDrawVisibleObjects()
+{
+    for (size_t i = 0; i < gSceneObjects.size(); ++i)
+    {
+        if (!gCuller.IsVisible(i))
+            continue;
 
-    //Bind textures to corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gPlane);
+        // scene graph matrices are looked up again, the nodes can be reordered
+        const SceneObject& object = gSceneObjects[i];
+        const glm::mat4& model = object.Node != SceneGraph::NONE ? gSceneGraph.Model(object.Node) : *object.Model;
+        UDrawCube(*object.Mesh, *object.Texture, model);
+    }
+}
 
-    // Draws the triangle
-    glDrawElements(GL_TRIANGLES, plane.nVertices, GL_UNSIGNED_SHORT, NULL); // Draws the triangle
 
-    glBindVertexArray(0);
+// Places the objects of the scene. The transforms are the ones each object used to be drawn with, split into
+// a node transform that children inherit and a mesh scale that they do not.
+void UCreateSceneGraph()
+{
+    // Charger body, lowered onto the plane and stretched upwards
+    gChargerNode = gSceneGraph.Add(SceneGraph::NONE, glm::translate(glm::vec3(0.0f, -1.0f, 0.0f)), glm::vec3(1.0f, 1.2f, 1.0f));
 
-    glfwSwapBuffers(gWindow);
+    // Prongs, relative to the unscaled charger body
+    gProngOneNode = gSceneGraph.Add(gChargerNode, glm::translate(glm::vec3(0.35f, 1.1f, -0.75f)), glm::vec3(0.3f, 0.8f, 0.05f));
+    gProngTwoNode = gSceneGraph.Add(gChargerNode, glm::translate(glm::vec3(0.35f, 1.1f, -0.2f)), glm::vec3(0.3f, 0.8f, 0.05f));
 
+    // Eraser body, turned and moved to the left; the head shares its transform and only differs in size
+    glm::mat4 eraser = glm::rotate(15.0f, glm::vec3(4.0f, 7.0f, -7.0f)) * glm::translate(glm::vec3(-3.5f, -1.5f, 1.1f));
+    gEraserBodyNode = gSceneGraph.Add(SceneGraph::NONE, eraser, glm::vec3(1.0f, -2.5f, 0.55f));
+    gEraserHeadNode = gSceneGraph.Add(gEraserBodyNode, glm::mat4(1.0f), glm::vec3(1.0f, 0.9f, 0.55f));
 
+    // Plane, a flattened box laid under the objects
+    glm::mat4 ground = glm::rotate(90.0f, glm::vec3(-0.5f, 0.5f, 0.5f)) * glm::translate(glm::vec3(-10.0f, -10.0f, -1.0f));
+    gPlaneNode = gSceneGraph.Add(SceneGraph::NONE, ground, glm::vec3(20.0f, 20.0f, 0.1f));
 }
 
 
+// Lays count small boxes out in a grid over the plane, sharing the plane's mesh and the charger's texture
+void UCreateBoxEntities(int count)
+{
+    int side = (int)std::ceil(std::sqrt((float)count));
+    for (int b = 0; b < count; ++b)
+    {
+        glm::vec3 position(-10.0f + 20.0f * (b % side) / side, -1.5f, -10.0f + 20.0f * (b / side) / side);
+
+        Entity box = gEntities.Create();
+        gSceneObjectsChanged = true;
+        gEntities.Transforms.Set(box, position, glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(0.05f));
+        MeshComponent mesh = { &plane };
+        gEntities.Meshes.Set(box, mesh);
+        MaterialComponent material = { gPlugBodyId };
+        gEntities.Materials.Set(box, material);
+    }
+}
 
 
 void UCreateCube(GLMesh& mesh) {
@@ -860,109 +1378,95 @@ void UCreateCube(GLMesh& mesh) {
 
 
 
-    //Cube 1
-
-    glGenVertexArrays(4, &mesh.vao);
-    glBindVertexArray(mesh.vao);
-
-
-    glGenBuffers(4, mesh.vbos);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(cubeVerts), cubeVerts, GL_STATIC_DRAW);
-
-    //Data for the indices
-    mesh.nVertices = sizeof(cubeIndices) / sizeof(cubeIndices[0]);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(cubeIndices), cubeIndices, GL_STATIC_DRAW);
-
-    //Strides between vertex coordinates is 7
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerUV);
-
-
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
-
-    glVertexAttribPointer(1, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(float) * floatsPerVertex));
-    glEnableVertexAttribArray(1);
-
-
+    // Welds the unrolled vertices and reorders the triangles before uploading
+    std::vector<GLfloat> vertices(cubeVerts, cubeVerts + sizeof(cubeVerts) / sizeof(cubeVerts[0]));
+    std::vector<unsigned int> indices(cubeIndices, cubeIndices + sizeof(cubeIndices) / sizeof(cubeIndices[0]));
+    UCreateOptimizedMesh(mesh, vertices, indices, floatsPerVertex, floatsPerUV, "Cube");
 }
 
 
-
-// Implements the UCreateShaders function
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId)
+// Builds a closed cylinder around the y axis from the steps/radius parameters of the pole prototype.
+// Every triangle is emitted with its own vertices, the optimizer welds them afterwards.
+void UCreateCylinder(GLMesh& mesh)
 {
-    // Compilation and linkage error reporting
-    int success = 0;
-    char infoLog[512];
-
-    // Create a Shader program object.
-    programId = glCreateProgram();
-
-    // Create the vertex and fragment shader objects
-    GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
-    GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
+    const GLuint floatsPerVertex = 3;
+    const GLuint floatsPerUV = 2;
+    const float pi = 3.1415926f;
+    const float angle = pi * 2.0f / steps;
 
-    // Retrive the shader source
-    glShaderSource(vertexShaderId, 1, &vtxShaderSource, NULL);
-    glShaderSource(fragmentShaderId, 1, &fragShaderSource, NULL);
+    std::vector<GLfloat> vertices;
+    std::vector<unsigned int> indices;
 
-    // Compile the vertex shader, and print compilation errors (if any)
-    glCompileShader(vertexShaderId); // compile the vertex shader
-    // check for shader compile errors
-    glGetShaderiv(vertexShaderId, GL_COMPILE_STATUS, &success);
-    if (!success)
+    // appends one vertex and indexes it
+    auto addVertex = [&](float x, float y, float z, float u, float v)
     {
-        glGetShaderInfoLog(vertexShaderId, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
+        GLfloat vertex[] = { x, y, z, u, v };
+        indices.push_back((unsigned int)(vertices.size() / (floatsPerVertex + floatsPerUV)));
+        vertices.insert(vertices.end(), vertex, vertex + 5);
+    };
 
-        return false;
+    for (int i = 0; i < steps; ++i)
+    {
+        float x0 = xPos + radius * cos(angle * i);
+        float z0 = yPos + radius * sin(angle * i);
+        float x1 = xPos + radius * cos(angle * (i + 1));
+        float z1 = yPos + radius * sin(angle * (i + 1));
+        float u0 = (float)i / steps;
+        float u1 = (float)(i + 1) / steps;
+
+        // Side quad
+        addVertex(x0, 0.0f, z0, u0, 0.0f);
+        addVertex(x1, 0.0f, z1, u1, 0.0f);
+        addVertex(x0, 1.0f, z0, u0, 1.0f);
+
+        addVertex(x1, 0.0f, z1, u1, 0.0f);
+        addVertex(x1, 1.0f, z1, u1, 1.0f);
+        addVertex(x0, 1.0f, z0, u0, 1.0f);
+
+        // Top and bottom caps fan out from the center
+        addVertex(xPos, 1.0f, yPos, 0.5f, 0.5f);
+        addVertex(x0, 1.0f, z0, 0.5f + 0.5f * cos(angle * i), 0.5f + 0.5f * sin(angle * i));
+        addVertex(x1, 1.0f, z1, 0.5f + 0.5f * cos(angle * (i + 1)), 0.5f + 0.5f * sin(angle * (i + 1)));
+
+        addVertex(xPos, 0.0f, yPos, 0.5f, 0.5f);
+        addVertex(x1, 0.0f, z1, 0.5f + 0.5f * cos(angle * (i + 1)), 0.5f + 0.5f * sin(angle * (i + 1)));
+        addVertex(x0, 0.0f, z0, 0.5f + 0.5f * cos(angle * i), 0.5f + 0.5f * sin(angle * i));
     }
 
-    glCompileShader(fragmentShaderId); // compile the fragment shader
-    // check for shader compile errors
-    glGetShaderiv(fragmentShaderId, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(fragmentShaderId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
+    UCreateOptimizedMesh(mesh, vertices, indices, floatsPerVertex, floatsPerUV, "Cylinder");
+}
 
-        return false;
-    }
 
-    // Attached compiled shaders to the shader program
-    glAttachShader(programId, vertexShaderId);
-    glAttachShader(programId, fragmentShaderId);
+// Runs generated geometry through the mesh optimizer, reports the vertex cache efficiency and uploads
+// the result through the registry so identical meshes still share buffers.
+void UCreateOptimizedMesh(GLMesh& mesh, std::vector<GLfloat>& vertices, std::vector<unsigned int>& indices, GLuint floatsPerVertex, GLuint floatsPerUV, const char* name)
+{
+    MeshOptimizeReport report = OptimizeMesh(vertices, indices, floatsPerVertex + floatsPerUV);
 
-    glLinkProgram(programId);   // links the shader program
-    // check for linking errors
-    glGetProgramiv(programId, GL_LINK_STATUS, &success);
-    if (!success)
-    {
-        glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+    std::cout << "INFO: " << name << " mesh: " << report.VerticesBefore << " -> " << report.VerticesAfter << " vertices, "
+        << report.Triangles << " triangles, ACMR " << report.AcmrBefore << " -> " << report.AcmrAfter << std::endl;
 
-        return false;
+    // Meshes are drawn with 16 bit indices
+    if (report.VerticesAfter > 65536)
+    {
+        std::cout << "ERROR: " << name << " mesh has too many vertices for 16 bit indices" << std::endl;
+        mesh = GLMesh();
+        return;
     }
 
-    glUseProgram(programId);    // Uses the shader program
-    glDeleteShader(vertexShaderId);
-    glDeleteShader(fragmentShaderId);
-    return true;
-}
+    std::vector<GLushort> shortIndices(indices.begin(), indices.end());
 
+    // Identical meshes share one set of buffers, only the first call uploads
+    mesh = gMeshRegistry.Acquire(vertices.data(), report.VerticesAfter, shortIndices.data(), shortIndices.size(), floatsPerVertex, floatsPerUV);
 
-void UDestroyShaderProgram(GLuint programId)
-{
-    glDeleteProgram(programId);
+    // A second copy in the shared pool serves the multi-draw path
+    mesh.poolMesh = gGeometryPool.Add(mesh.key, vertices.data(), report.VerticesAfter, shortIndices.data(), (GLuint)shortIndices.size(), floatsPerVertex + floatsPerUV);
 }
 
 
 void UDestroyMesh(GLMesh& mesh)
 {
-    glDeleteVertexArrays(1, &mesh.vao);
-    glDeleteBuffers(2, mesh.vbos);
+    // The buffers are only freed once no other mesh shares them
+    gMeshRegistry.Release(mesh);
 }
 
@@ -0,0 +1,484 @@
+#ifndef TEXTURE_ATLAS_H
+#define TEXTURE_ATLAS_H
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include <MipChain.h>
+#include <PixelUploadRing.h>
+#include <TextureCompressor.h>
+#include <TextureLoader.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+// Where a texture ended up inside the atlas
+struct AtlasRegion
+{
+    float Layer;          // array layer, -1 when the texture is not in the atlas
+    glm::vec4 Transform;  // atlas uv = uv * Transform.xy + Transform.zw
+};
+
+// Shelf rectangle packer: rectangles are placed left to right on horizontal shelves, each new shelf
+// opening below the last. Packing tallest first keeps the wasted space above short rectangles small.
+class ShelfPacker
+{
+public:
+    ShelfPacker(int width, int height) : width(width), height(height), top(0)
+    {
+    }
+
+    bool Insert(int w, int h, int& x, int& y)
+    {
+        // the lowest shelf the rectangle fits on wastes the least height
+        int best = -1;
+        for (size_t i = 0; i < shelves.size(); ++i)
+        {
+            if (h <= shelves[i].Height && shelves[i].X + w <= width && (best < 0 || shelves[i].Height < shelves[best].Height))
+                best = (int)i;
+        }
+
+        if (best < 0)
+        {
+            if (top + h > height || w > width)
+                return false;
+            Shelf shelf = { top, h, 0 };
+            shelves.push_back(shelf);
+            top += h;
+            best = (int)shelves.size() - 1;
+        }
+
+        x = shelves[best].X;
+        y = shelves[best].Y;
+        shelves[best].X += w;
+        return true;
+    }
+
+private:
+    struct Shelf
+    {
+        int Y;
+        int Height;
+        int X;
+    };
+
+    int width;
+    int height;
+    int top;
+    std::vector<Shelf> shelves;
+};
+
+// Packs every texture of the scene into one GL_TEXTURE_2D_ARRAY so the whole scene draws with a single
+// texture binding. Textures of one common size get a layer each and keep repeat wrapping; otherwise they
+// are shelf-packed into square layers with a gutter of replicated edge texels around each one. Textures
+// are added with the mip chain the loader built, either block-compressed or as 8 bit pixels, and their
+// levels are copied into the layers as they are, whole blocks at a time for compressed data.
+class TextureAtlas
+{
+public:
+    // packed placements are aligned to this and surrounded by a gutter of the same width, so each of
+    // the first PACKED_LEVELS levels still starts on a 4x4 block boundary with at least a block of gutter
+    static const int ALIGNMENT = 32;
+    static const int PACKED_LEVELS = 4;
+
+    GLuint Texture;
+    int LayerWidth;
+    int LayerHeight;
+    int Layers;
+    int Levels;
+    GLenum Format;    // GL_RGBA8 or a compressed S3TC format
+    bool Packed;      // textures share layers
+    int MaxLayerSize;
+
+    TextureAtlas() : Texture(0), LayerWidth(0), LayerHeight(0), Layers(0), Levels(0), Format(0), Packed(false), MaxLayerSize(4096)
+    {
+    }
+
+    // creates a 1x1 grey array so there is something to bind until Build
+    void Create()
+    {
+        GLint maxSize = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+        if (maxSize > 0)
+            MaxLayerSize = std::min(MaxLayerSize, (int)maxSize);
+
+        const unsigned char grey[] = { 128, 128, 128, 255 };
+        glGenTextures(1, &Texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, Texture);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA8, 1, 1, 1);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, 1, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+
+    void Destroy()
+    {
+        glDeleteTextures(1, &Texture);
+        Texture = 0;
+        sources.clear();
+        regions.clear();
+    }
+
+    // Takes a decoded image for textureId; its levels are kept until Build. Pixels with fewer than four
+    // channels are expanded to RGBA.
+    void Add(GLuint textureId, DecodedImage& image)
+    {
+        Source source;
+        source.TextureId = textureId;
+        source.Compressed = !image.Compressed.Levels.empty();
+        source.Format = source.Compressed ? image.Compressed.Format : GL_RGBA8;
+
+        if (source.Compressed)
+        {
+            for (size_t i = 0; i < image.Compressed.Levels.size(); ++i)
+                source.Levels.push_back(Level { image.Compressed.Levels[i].Width, image.Compressed.Levels[i].Height, std::move(image.Compressed.Levels[i].Data) });
+        }
+        else
+        {
+            source.Levels.push_back(Level { image.Width, image.Height, toRgba(image.Pixels, image.Width, image.Height, image.Channels) });
+            for (size_t i = 0; i < image.Mips.size(); ++i)
+                source.Levels.push_back(Level { image.Mips[i].Width, image.Mips[i].Height, toRgba(image.Mips[i].Pixels.data(), image.Mips[i].Width, image.Mips[i].Height, image.Channels) });
+        }
+
+        sources.push_back(std::move(source));
+    }
+
+    bool Find(GLuint textureId, AtlasRegion& region) const
+    {
+        std::unordered_map<GLuint, AtlasRegion>::const_iterator found = regions.find(textureId);
+        if (found == regions.end())
+        {
+            region.Layer = -1.0f;
+            region.Transform = glm::vec4(1.0f, 1.0f, 0.0f, 0.0f);
+            return false;
+        }
+        region = found->second;
+        return true;
+    }
+
+    // Lays out and uploads every added texture, replacing the placeholder array. Returns false when
+    // nothing could be placed.
+    bool Build(PixelUploadRing& ring)
+    {
+        if (sources.empty())
+            return false;
+
+        // The loader leaves images with one or two channels uncompressed, those are compressed to BC3
+        // here when the rest of the scene is
+        bool compressed = false;
+        for (size_t i = 0; i < sources.size(); ++i)
+            compressed = compressed || sources[i].Compressed;
+        if (compressed)
+            for (size_t i = 0; i < sources.size(); ++i)
+                compressToBc3(sources[i]);
+
+        // one array format for everything: BC1 only when every source is BC1, BC1 blocks become BC3 otherwise
+        Format = compressed ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_RGBA8;
+        for (size_t i = 0; i < sources.size(); ++i)
+            if (sources[i].Format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+                Format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        if (Format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+            for (size_t i = 0; i < sources.size(); ++i)
+                expandToBc3(sources[i]);
+
+        // textures larger than a layer start at the first mip level that fits
+        for (size_t i = 0; i < sources.size(); ++i)
+            while (sources[i].Levels.size() > 1 && (sources[i].Levels[0].Width > MaxLayerSize || sources[i].Levels[0].Height > MaxLayerSize))
+                sources[i].Levels.erase(sources[i].Levels.begin());
+
+        Packed = false;
+        for (size_t i = 1; i < sources.size(); ++i)
+            if (sources[i].Levels[0].Width != sources[0].Levels[0].Width || sources[i].Levels[0].Height != sources[0].Levels[0].Height)
+                Packed = true;
+
+        if (Packed)
+            pack();
+        else
+            stack();
+
+        upload(ring);
+        sources.clear();
+        return true;
+    }
+
+private:
+    struct Level
+    {
+        int Width;
+        int Height;
+        std::vector<unsigned char> Data; // RGBA8 pixels or compressed blocks
+    };
+
+    struct Source
+    {
+        GLuint TextureId;
+        bool Compressed;
+        GLenum Format;
+        std::vector<Level> Levels;
+    };
+
+    std::vector<Source> sources;
+    std::unordered_map<GLuint, AtlasRegion> regions;
+    std::vector<std::vector<std::vector<unsigned char> > > layerData; // [layer][level]
+
+    static std::vector<unsigned char> toRgba(const unsigned char* pixels, int width, int height, int channels)
+    {
+        std::vector<unsigned char> rgba((size_t)width * height * 4);
+        for (size_t i = 0; i < (size_t)width * height; ++i)
+        {
+            // grey and grey-alpha images repeat their first channel
+            const unsigned char* pixel = pixels + i * channels;
+            for (int c = 0; c < 3; ++c)
+                rgba[i * 4 + c] = channels >= 3 ? pixel[c] : pixel[0];
+            rgba[i * 4 + 3] = channels == 4 ? pixel[3] : (channels == 2 ? pixel[1] : 255);
+        }
+        return rgba;
+    }
+
+    // compresses the RGBA levels of an uncompressed source into BC3 blocks
+    static void compressToBc3(Source& source)
+    {
+        if (source.Compressed)
+            return;
+
+        for (size_t l = 0; l < source.Levels.size(); ++l)
+        {
+            Level& level = source.Levels[l];
+            level.Data = CompressImage(level.Data.data(), level.Width, level.Height, 4, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT);
+        }
+        source.Compressed = true;
+        source.Format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    }
+
+    // prefixes every BC1 block with an opaque alpha block, the compressor always writes four colour blocks
+    static void expandToBc3(Source& source)
+    {
+        if (source.Format != GL_COMPRESSED_RGB_S3TC_DXT1_EXT)
+            return;
+
+        const unsigned char opaque[8] = { 255, 255, 0, 0, 0, 0, 0, 0 };
+        for (size_t l = 0; l < source.Levels.size(); ++l)
+        {
+            std::vector<unsigned char>& data = source.Levels[l].Data;
+            std::vector<unsigned char> expanded(data.size() * 2);
+            for (size_t b = 0; b < data.size() / 8; ++b)
+            {
+                std::memcpy(&expanded[b * 16], opaque, 8);
+                std::memcpy(&expanded[b * 16 + 8], &data[b * 8], 8);
+            }
+            data.swap(expanded);
+        }
+        source.Format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    }
+
+    bool isCompressed() const
+    {
+        return Format != GL_RGBA8;
+    }
+
+    size_t cellBytes() const
+    {
+        return Format == GL_RGBA8 ? 4 : (Format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT ? 16 : 8);
+    }
+
+    // size of a level in cells, a cell being a pixel or a 4x4 block
+    void cells(int width, int height, int& columns, int& rows) const
+    {
+        columns = isCompressed() ? (width + 3) / 4 : width;
+        rows = isCompressed() ? (height + 3) / 4 : height;
+    }
+
+    void allocateLayers(int layers)
+    {
+        Layers = layers;
+        layerData.assign(layers, std::vector<std::vector<unsigned char> >(Levels));
+        for (int layer = 0; layer < layers; ++layer)
+        {
+            for (int level = 0; level < Levels; ++level)
+            {
+                int columns, rows;
+                cells(std::max(1, LayerWidth >> level), std::max(1, LayerHeight >> level), columns, rows);
+                layerData[layer][level].assign((size_t)columns * rows * cellBytes(), 0);
+            }
+        }
+    }
+
+    // copies a source level to cell (x, y) of a layer level, replicating its edge cells gutter cells outwards
+    void blit(const Level& level, int layer, int levelIndex, int x, int y, int gutter)
+    {
+        int srcColumns, srcRows, dstColumns, dstRows;
+        cells(level.Width, level.Height, srcColumns, srcRows);
+        cells(std::max(1, LayerWidth >> levelIndex), std::max(1, LayerHeight >> levelIndex), dstColumns, dstRows);
+
+        size_t cell = cellBytes();
+        unsigned char* dst = layerData[layer][levelIndex].data();
+        for (int j = -gutter; j < srcRows + gutter; ++j)
+        {
+            int dy = y + j;
+            if (dy < 0 || dy >= dstRows)
+                continue;
+
+            const unsigned char* srcRow = &level.Data[(size_t)std::min(std::max(j, 0), srcRows - 1) * srcColumns * cell];
+            unsigned char* dstRow = dst + (size_t)dy * dstColumns * cell;
+            int columns = std::min(srcColumns, dstColumns - x);
+            if (columns > 0)
+                std::memcpy(dstRow + (size_t)x * cell, srcRow, (size_t)columns * cell);
+
+            for (int i = 1; i <= gutter; ++i)
+            {
+                if (x - i >= 0)
+                    std::memcpy(dstRow + (size_t)(x - i) * cell, srcRow, cell);
+                if (x + srcColumns - 1 + i < dstColumns)
+                    std::memcpy(dstRow + (size_t)(x + srcColumns - 1 + i) * cell, srcRow + (size_t)(srcColumns - 1) * cell, cell);
+            }
+        }
+    }
+
+    // every texture has the same size: one texture per layer, uvs unchanged
+    void stack()
+    {
+        LayerWidth = sources[0].Levels[0].Width;
+        LayerHeight = sources[0].Levels[0].Height;
+        Levels = (int)sources[0].Levels.size();
+        for (size_t i = 1; i < sources.size(); ++i)
+            Levels = std::min(Levels, (int)sources[i].Levels.size());
+
+        allocateLayers((int)sources.size());
+        for (size_t i = 0; i < sources.size(); ++i)
+        {
+            for (int level = 0; level < Levels; ++level)
+                blit(sources[i].Levels[level], (int)i, level, 0, 0, 0);
+
+            AtlasRegion region;
+            region.Layer = (float)i;
+            region.Transform = glm::vec4(1.0f, 1.0f, 0.0f, 0.0f);
+            regions[sources[i].TextureId] = region;
+        }
+    }
+
+    static int roundUp(int value, int multiple)
+    {
+        return (value + multiple - 1) / multiple * multiple;
+    }
+
+    // mixed sizes: shelf-pack into square layers, as many as it takes
+    void pack()
+    {
+        // textures whose padded footprint does not fit a layer give up their largest levels
+        for (size_t i = 0; i < sources.size(); ++i)
+            while (sources[i].Levels.size() > 1 && roundUp(std::max(sources[i].Levels[0].Width, sources[i].Levels[0].Height), ALIGNMENT) + 2 * ALIGNMENT > MaxLayerSize)
+                sources[i].Levels.erase(sources[i].Levels.begin());
+
+        int largest = 0;
+        Levels = PACKED_LEVELS;
+        for (size_t i = 0; i < sources.size(); ++i)
+        {
+            largest = std::max(largest, roundUp(std::max(sources[i].Levels[0].Width, sources[i].Levels[0].Height), ALIGNMENT) + 2 * ALIGNMENT);
+            Levels = std::min(Levels, (int)sources[i].Levels.size());
+        }
+
+        int size = ALIGNMENT;
+        while (size < largest && size < MaxLayerSize)
+            size *= 2;
+        LayerWidth = LayerHeight = size;
+
+        std::vector<size_t> order(sources.size());
+        for (size_t i = 0; i < order.size(); ++i)
+            order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) { return sources[a].Levels[0].Height > sources[b].Levels[0].Height; });
+
+        // place everything first, the number of layers is only known afterwards
+        struct Placement
+        {
+            size_t Source;
+            int Layer;
+            int X;
+            int Y;
+        };
+        std::vector<Placement> placements;
+        std::vector<ShelfPacker> packers;
+        for (size_t k = 0; k < order.size(); ++k)
+        {
+            const Level& base = sources[order[k]].Levels[0];
+            int w = roundUp(base.Width, ALIGNMENT) + 2 * ALIGNMENT;
+            int h = roundUp(base.Height, ALIGNMENT) + 2 * ALIGNMENT;
+
+            Placement placement = { order[k], 0, 0, 0 };
+            for (;; ++placement.Layer)
+            {
+                if (placement.Layer == (int)packers.size())
+                    packers.push_back(ShelfPacker(LayerWidth, LayerHeight));
+                if (packers[placement.Layer].Insert(w, h, placement.X, placement.Y))
+                    break;
+            }
+            placement.X += ALIGNMENT;
+            placement.Y += ALIGNMENT;
+            placements.push_back(placement);
+        }
+
+        allocateLayers((int)packers.size());
+        for (size_t k = 0; k < placements.size(); ++k)
+        {
+            const Placement& p = placements[k];
+            const Source& source = sources[p.Source];
+            for (int level = 0; level < Levels; ++level)
+            {
+                int gutter = ALIGNMENT >> level;
+                int x = p.X >> level;
+                int y = p.Y >> level;
+                if (isCompressed())
+                {
+                    gutter /= 4;
+                    x /= 4;
+                    y /= 4;
+                }
+                blit(source.Levels[level], p.Layer, level, x, y, gutter);
+            }
+
+            AtlasRegion region;
+            region.Layer = (float)p.Layer;
+            region.Transform = glm::vec4((float)source.Levels[0].Width / LayerWidth, (float)source.Levels[0].Height / LayerHeight,
+                (float)p.X / LayerWidth, (float)p.Y / LayerHeight);
+            regions[source.TextureId] = region;
+        }
+    }
+
+    void upload(PixelUploadRing& ring)
+    {
+        glDeleteTextures(1, &Texture);
+        glGenTextures(1, &Texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, Texture);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, Levels, Format, LayerWidth, LayerHeight, Layers);
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (int layer = 0; layer < Layers; ++layer)
+        {
+            for (int level = 0; level < Levels; ++level)
+            {
+                const std::vector<unsigned char>& data = layerData[layer][level];
+                GLsizei width = std::max(1, LayerWidth >> level);
+                GLsizei height = std::max(1, LayerHeight >> level);
+                if (isCompressed())
+                    ring.UploadCompressedLayer(level, layer, Format, width, height, data.data(), (GLsizeiptr)data.size());
+                else
+                    ring.UploadLayer(level, layer, width, height, GL_RGBA, data.data());
+            }
+        }
+        layerData.clear();
+
+        // packed textures would wrap into their neighbours
+        GLint wrap = Packed ? GL_CLAMP_TO_EDGE : GL_REPEAT;
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, wrap);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, wrap);
+        // trilinear sampling reads only the levels that were copied in. Packed layers stop after
+        // PACKED_LEVELS, the last levels whose gutter is still at least a block wide.
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, Levels - 1);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+};
+#endif
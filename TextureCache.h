@@ -0,0 +1,171 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <GL/glew.h>
+
+#include <TextureCompressor.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// bump whenever the compressor or mip filter changes so stale cache files are ignored
+const unsigned int TEXTURE_CACHE_VERSION = 2;
+
+// Stores compressed textures in Directory, one file per source image named after the hash of the
+// source file bytes. A cache hit skips decoding, mip generation and compression entirely.
+class TextureCache
+{
+public:
+    std::string Directory;
+
+    TextureCache() : Directory("./resources/texture_cache")
+    {
+    }
+
+    std::string FileName(unsigned long long sourceHash) const
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.bct", sourceHash);
+        return Directory + "/" + name;
+    }
+
+    // Every field read from the file is checked before anything is allocated for it, so a truncated or
+    // corrupt entry is just a miss
+    bool Load(unsigned long long sourceHash, CompressedTexture& texture) const
+    {
+        FILE* file = std::fopen(FileName(sourceHash).c_str(), "rb");
+        if (!file)
+            return false;
+
+        long remaining = 0;
+        if (std::fseek(file, 0, SEEK_END) == 0)
+            remaining = std::ftell(file);
+        std::rewind(file);
+
+        Header header;
+        bool ok = remaining >= (long)sizeof(header) && std::fread(&header, sizeof(header), 1, file) == 1 &&
+            header.Magic == MAGIC && header.Version == TEXTURE_CACHE_VERSION && header.Levels > 0 && header.Levels <= MAX_LEVELS &&
+            (header.Format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || header.Format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT);
+        remaining -= (long)sizeof(header);
+
+        if (ok)
+        {
+            texture.Format = header.Format;
+            texture.ContentHash = header.ContentHash;
+            texture.Levels.resize(header.Levels);
+            for (unsigned int i = 0; ok && i < header.Levels; ++i)
+            {
+                int size[2];
+                ok = remaining >= (long)sizeof(size) && std::fread(size, sizeof(size), 1, file) == 1;
+                remaining -= (long)sizeof(size);
+                if (!ok)
+                    break;
+
+                // level 0 can be any size up to the largest texture, every other one halves the one before
+                if (i == 0)
+                    ok = size[0] > 0 && size[1] > 0 && size[0] <= MAX_SIZE && size[1] <= MAX_SIZE;
+                else
+                    ok = size[0] == std::max(1, texture.Levels[i - 1].Width / 2) && size[1] == std::max(1, texture.Levels[i - 1].Height / 2);
+
+                size_t bytes = ok ? CompressedSize(size[0], size[1], texture.Format) : 0;
+                ok = ok && bytes <= (size_t)remaining;
+                if (!ok)
+                    break;
+
+                CompressedLevel& level = texture.Levels[i];
+                level.Width = size[0];
+                level.Height = size[1];
+                level.Data.resize(bytes);
+                ok = std::fread(level.Data.data(), level.Data.size(), 1, file) == 1;
+                remaining -= (long)bytes;
+            }
+        }
+
+        std::fclose(file);
+        if (!ok)
+            texture.Levels.clear();
+        return ok;
+    }
+
+    // writes to a temporary name first so a crash or a concurrent reader never sees half a file.
+    // Sources with identical bytes share a cache file, so every writer gets its own temporary name.
+    bool Store(unsigned long long sourceHash, const CompressedTexture& texture) const
+    {
+        makeDirectory();
+
+        std::string path = FileName(sourceHash);
+        std::string temporary = temporaryName(path);
+        FILE* file = std::fopen(temporary.c_str(), "wb");
+        if (!file)
+            return false;
+
+        Header header;
+        header.Magic = MAGIC;
+        header.Version = TEXTURE_CACHE_VERSION;
+        header.Format = texture.Format;
+        header.Levels = (unsigned int)texture.Levels.size();
+        header.ContentHash = texture.ContentHash;
+
+        bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+        for (size_t i = 0; ok && i < texture.Levels.size(); ++i)
+        {
+            const CompressedLevel& level = texture.Levels[i];
+            int size[2] = { level.Width, level.Height };
+            ok = std::fwrite(size, sizeof(size), 1, file) == 1 &&
+                std::fwrite(level.Data.data(), level.Data.size(), 1, file) == 1;
+        }
+
+        ok = std::fclose(file) == 0 && ok;
+        if (ok)
+        {
+            std::remove(path.c_str());
+            ok = std::rename(temporary.c_str(), path.c_str()) == 0;
+        }
+        if (!ok)
+            std::remove(temporary.c_str());
+        return ok;
+    }
+
+private:
+    static std::string temporaryName(const std::string& path)
+    {
+        static std::atomic<unsigned int> counter(0);
+        char suffix[48];
+        std::snprintf(suffix, sizeof(suffix), ".%zx.%x.tmp", std::hash<std::thread::id>()(std::this_thread::get_id()), counter++);
+        return path + suffix;
+    }
+
+    static const unsigned int MAGIC = 0x31544342; // "BCT1"
+    static const unsigned int MAX_LEVELS = 32;
+    static const int MAX_SIZE = 65536;
+
+    struct Header
+    {
+        unsigned int Magic;
+        unsigned int Version;
+        unsigned int Format;
+        unsigned int Levels;
+        unsigned long long ContentHash;
+    };
+
+    void makeDirectory() const
+    {
+#ifdef _WIN32
+        _mkdir(Directory.c_str());
+#else
+        mkdir(Directory.c_str(), 0755);
+#endif
+    }
+};
+#endif
@@ -0,0 +1,523 @@
+#ifndef TEXTURE_COMPRESSOR_H
+#define TEXTURE_COMPRESSOR_H
+
+#include <GL/glew.h>
+
+#include <ImageUtils.h>
+#include <MipChain.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXTURE_COMPRESSOR_SSE2
+#include <emmintrin.h>
+#endif
+
+// CPU block compression into the S3TC formats every desktop GPU samples natively:
+//  BC1 (GL_COMPRESSED_RGB_S3TC_DXT1_EXT)  4x4 RGB block in 8 bytes, for opaque images
+//  BC3 (GL_COMPRESSED_RGBA_S3TC_DXT5_EXT) BC1 colour plus an 8 byte interpolated alpha block
+// Endpoints come from the principal axis of each block's colours and are refined once by least
+// squares. Palette matching runs four pixels at a time with SSE2 where available, and block rows are
+// split across threads.
+
+// One mip level of a compressed texture
+struct CompressedLevel
+{
+    int Width;
+    int Height;
+    std::vector<unsigned char> Data;
+};
+
+// A block-compressed texture with its whole mip chain, as stored in the on-disk cache
+struct CompressedTexture
+{
+    GLenum Format;                  // GL_COMPRESSED_RGB_S3TC_DXT1_EXT or GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+    unsigned long long ContentHash; // hash of the decoded pixels, so content deduplication works on cache hits
+    std::vector<CompressedLevel> Levels;
+};
+
+namespace bc
+{
+    inline unsigned short pack565(const float* rgb)
+    {
+        int r = (int)(std::min(std::max(rgb[0], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+        int g = (int)(std::min(std::max(rgb[1], 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+        int b = (int)(std::min(std::max(rgb[2], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+        return (unsigned short)((r << 11) | (g << 5) | b);
+    }
+
+    inline void unpack565(unsigned short c, float* rgb)
+    {
+        int r = (c >> 11) & 31;
+        int g = (c >> 5) & 63;
+        int b = c & 31;
+        rgb[0] = (float)((r << 3) | (r >> 2));
+        rgb[1] = (float)((g << 2) | (g >> 4));
+        rgb[2] = (float)((b << 3) | (b >> 2));
+    }
+
+    // four colour palette for c0 > c1
+    inline void palette(unsigned short c0, unsigned short c1, float colors[4][3])
+    {
+        unpack565(c0, colors[0]);
+        unpack565(c1, colors[1]);
+        for (int k = 0; k < 3; ++k)
+        {
+            colors[2][k] = (2.0f * colors[0][k] + colors[1][k]) / 3.0f;
+            colors[3][k] = (colors[0][k] + 2.0f * colors[1][k]) / 3.0f;
+        }
+    }
+
+    // picks the nearest palette entry for every pixel, returns the packed indices and the squared error
+    inline unsigned int assignIndices(const float pixels[16][3], const float colors[4][3], float& error)
+    {
+        unsigned int indices = 0;
+#ifdef TEXTURE_COMPRESSOR_SSE2
+        __m128 totalError = _mm_setzero_ps();
+        for (int i = 0; i < 16; i += 4)
+        {
+            __m128 r = _mm_setr_ps(pixels[i][0], pixels[i + 1][0], pixels[i + 2][0], pixels[i + 3][0]);
+            __m128 g = _mm_setr_ps(pixels[i][1], pixels[i + 1][1], pixels[i + 2][1], pixels[i + 3][1]);
+            __m128 b = _mm_setr_ps(pixels[i][2], pixels[i + 1][2], pixels[i + 2][2], pixels[i + 3][2]);
+
+            __m128 bestDistance = _mm_set1_ps(1e30f);
+            __m128i best = _mm_setzero_si128();
+            for (int p = 0; p < 4; ++p)
+            {
+                __m128 dr = _mm_sub_ps(r, _mm_set1_ps(colors[p][0]));
+                __m128 dg = _mm_sub_ps(g, _mm_set1_ps(colors[p][1]));
+                __m128 db = _mm_sub_ps(b, _mm_set1_ps(colors[p][2]));
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+
+                __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, bestDistance));
+                best = _mm_or_si128(_mm_andnot_si128(closer, best), _mm_and_si128(closer, _mm_set1_epi32(p)));
+                bestDistance = _mm_min_ps(distance, bestDistance);
+            }
+
+            totalError = _mm_add_ps(totalError, bestDistance);
+            int lanes[4];
+            _mm_storeu_si128((__m128i*)lanes, best);
+            for (int k = 0; k < 4; ++k)
+                indices |= (unsigned int)lanes[k] << (2 * (i + k));
+        }
+
+        float lanes[4];
+        _mm_storeu_ps(lanes, totalError);
+        error = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#else
+        error = 0.0f;
+        for (int i = 0; i < 16; ++i)
+        {
+            int best = 0;
+            float bestDistance = 1e30f;
+            for (int p = 0; p < 4; ++p)
+            {
+                float dr = pixels[i][0] - colors[p][0];
+                float dg = pixels[i][1] - colors[p][1];
+                float db = pixels[i][2] - colors[p][2];
+                float distance = dr * dr + dg * dg + db * db;
+                if (distance < bestDistance)
+                {
+                    bestDistance = distance;
+                    best = p;
+                }
+            }
+            indices |= (unsigned int)best << (2 * i);
+            error += bestDistance;
+        }
+#endif
+        return indices;
+    }
+
+    // writes an 8 byte BC1 block, always in four colour mode so it is also valid as the colour half of BC3
+    inline void encodeColorBlock(const float pixels[16][3], unsigned char* out)
+    {
+        // principal axis of the block's colours by power iteration on the covariance matrix
+        float mean[3] = { 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 16; ++i)
+            for (int k = 0; k < 3; ++k)
+                mean[k] += pixels[i][k] / 16.0f;
+
+        float cov[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 16; ++i)
+        {
+            float r = pixels[i][0] - mean[0];
+            float g = pixels[i][1] - mean[1];
+            float b = pixels[i][2] - mean[2];
+            cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+            cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+        }
+
+        float axis[3] = { 1.0f, 1.0f, 1.0f };
+        for (int iteration = 0; iteration < 8; ++iteration)
+        {
+            float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+            float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+            float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+            float length = std::max(std::max(std::fabs(x), std::fabs(y)), std::fabs(z));
+            if (length < 1e-6f)
+                break;
+            axis[0] = x / length;
+            axis[1] = y / length;
+            axis[2] = z / length;
+        }
+
+        float axisLengthSquared = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+        float minT = 0.0f;
+        float maxT = 0.0f;
+        for (int i = 0; i < 16; ++i)
+        {
+            float t = ((pixels[i][0] - mean[0]) * axis[0] + (pixels[i][1] - mean[1]) * axis[1] + (pixels[i][2] - mean[2]) * axis[2]) / axisLengthSquared;
+            minT = std::min(minT, t);
+            maxT = std::max(maxT, t);
+        }
+
+        float end0[3];
+        float end1[3];
+        for (int k = 0; k < 3; ++k)
+        {
+            end0[k] = mean[k] + axis[k] * maxT;
+            end1[k] = mean[k] + axis[k] * minT;
+        }
+
+        unsigned short c0 = pack565(end0);
+        unsigned short c1 = pack565(end1);
+        float colors[4][3];
+        palette(c0, c1, colors);
+        float error;
+        unsigned int indices = assignIndices(pixels, colors, error);
+
+        // least squares refinement of both endpoints for the chosen indices
+        const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+        float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+        float ax[3] = { 0.0f, 0.0f, 0.0f };
+        float bx[3] = { 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 16; ++i)
+        {
+            float a = weights[(indices >> (2 * i)) & 3];
+            float b = 1.0f - a;
+            aa += a * a;
+            ab += a * b;
+            bb += b * b;
+            for (int k = 0; k < 3; ++k)
+            {
+                ax[k] += a * pixels[i][k];
+                bx[k] += b * pixels[i][k];
+            }
+        }
+
+        float determinant = aa * bb - ab * ab;
+        if (std::fabs(determinant) > 1e-6f)
+        {
+            float refined0[3];
+            float refined1[3];
+            for (int k = 0; k < 3; ++k)
+            {
+                refined0[k] = (ax[k] * bb - bx[k] * ab) / determinant;
+                refined1[k] = (bx[k] * aa - ax[k] * ab) / determinant;
+            }
+
+            unsigned short r0 = pack565(refined0);
+            unsigned short r1 = pack565(refined1);
+            float refinedColors[4][3];
+            palette(r0, r1, refinedColors);
+            float refinedError;
+            unsigned int refinedIndices = assignIndices(pixels, refinedColors, refinedError);
+            if (refinedError < error)
+            {
+                c0 = r0;
+                c1 = r1;
+                indices = refinedIndices;
+            }
+        }
+
+        // four colour mode needs c0 > c1, swapping the endpoints swaps indices 0<->1 and 2<->3
+        if (c0 < c1)
+        {
+            std::swap(c0, c1);
+            indices ^= 0x55555555u;
+        }
+        else if (c0 == c1)
+        {
+            indices = 0;
+        }
+
+        out[0] = (unsigned char)(c0 & 0xff);
+        out[1] = (unsigned char)(c0 >> 8);
+        out[2] = (unsigned char)(c1 & 0xff);
+        out[3] = (unsigned char)(c1 >> 8);
+        out[4] = (unsigned char)(indices & 0xff);
+        out[5] = (unsigned char)((indices >> 8) & 0xff);
+        out[6] = (unsigned char)((indices >> 16) & 0xff);
+        out[7] = (unsigned char)(indices >> 24);
+    }
+
+    // writes the 8 byte BC3 alpha block using the eight value mode (a0 > a1)
+    inline void encodeAlphaBlock(const unsigned char alpha[16], unsigned char* out)
+    {
+        int a0 = 0;
+        int a1 = 255;
+        for (int i = 0; i < 16; ++i)
+        {
+            a0 = std::max(a0, (int)alpha[i]);
+            a1 = std::min(a1, (int)alpha[i]);
+        }
+
+        unsigned long long indices = 0;
+        if (a0 > a1)
+        {
+            for (int i = 0; i < 16; ++i)
+            {
+                // position along a0 -> a1 in sevenths, then map to the block's index order
+                int step = (int)((float)(a0 - alpha[i]) * 7.0f / (float)(a0 - a1) + 0.5f);
+                int index = step == 0 ? 0 : (step == 7 ? 1 : step + 1);
+                indices |= (unsigned long long)index << (3 * i);
+            }
+        }
+
+        out[0] = (unsigned char)a0;
+        out[1] = (unsigned char)a1;
+        for (int b = 0; b < 6; ++b)
+            out[2 + b] = (unsigned char)((indices >> (8 * b)) & 0xff);
+    }
+
+    // gathers a 4x4 block, clamping at the image edge for sizes that are not a multiple of four
+    inline void loadBlock(const unsigned char* image, int width, int height, int channels, int bx, int by, float rgb[16][3], unsigned char alpha[16])
+    {
+        for (int y = 0; y < 4; ++y)
+        {
+            int sy = std::min(by * 4 + y, height - 1);
+            for (int x = 0; x < 4; ++x)
+            {
+                int sx = std::min(bx * 4 + x, width - 1);
+                const unsigned char* pixel = image + ((size_t)sy * width + sx) * channels;
+                rgb[y * 4 + x][0] = pixel[0];
+                rgb[y * 4 + x][1] = pixel[1];
+                rgb[y * 4 + x][2] = pixel[2];
+                alpha[y * 4 + x] = channels == 4 ? pixel[3] : 255;
+            }
+        }
+    }
+
+    // decoders, used to measure the compression error on the CPU
+    inline void decodeColorBlock(const unsigned char* in, unsigned char out[16][4])
+    {
+        unsigned short c0 = (unsigned short)(in[0] | (in[1] << 8));
+        unsigned short c1 = (unsigned short)(in[2] | (in[3] << 8));
+        unsigned int indices = in[4] | (in[5] << 8) | (in[6] << 16) | ((unsigned int)in[7] << 24);
+        float colors[4][3];
+        palette(c0, c1, colors);
+        for (int i = 0; i < 16; ++i)
+        {
+            const float* c = colors[(indices >> (2 * i)) & 3];
+            out[i][0] = (unsigned char)(c[0] + 0.5f);
+            out[i][1] = (unsigned char)(c[1] + 0.5f);
+            out[i][2] = (unsigned char)(c[2] + 0.5f);
+            out[i][3] = 255;
+        }
+    }
+
+    inline void decodeAlphaBlock(const unsigned char* in, unsigned char out[16][4])
+    {
+        int a0 = in[0];
+        int a1 = in[1];
+        int values[8] = { a0, a1 };
+        for (int k = 1; k < 7; ++k)
+            values[k + 1] = a0 > a1 ? ((7 - k) * a0 + k * a1) / 7 : 0;
+
+        unsigned long long indices = 0;
+        for (int b = 0; b < 6; ++b)
+            indices |= (unsigned long long)in[2 + b] << (8 * b);
+        for (int i = 0; i < 16; ++i)
+            out[i][3] = (unsigned char)values[(indices >> (3 * i)) & 7];
+    }
+}
+
+// true when every pixel is opaque, such images can use BC1
+inline bool IsOpaque(const unsigned char* image, int width, int height, int channels)
+{
+    if (channels < 4)
+        return true;
+    for (size_t i = 3; i < (size_t)width * height * 4; i += 4)
+        if (image[i] != 255)
+            return false;
+    return true;
+}
+
+inline size_t CompressedSize(int width, int height, GLenum format)
+{
+    size_t blocks = (size_t)((width + 3) / 4) * ((height + 3) / 4);
+    return blocks * (format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT ? 16 : 8);
+}
+
+// Compresses an RGB or RGBA image into BC1 or BC3. threadCount 0 uses every core.
+inline std::vector<unsigned char> CompressImage(const unsigned char* image, int width, int height, int channels, GLenum format, unsigned int threadCount = 0)
+{
+    int blocksX = (width + 3) / 4;
+    int blocksY = (height + 3) / 4;
+    size_t blockBytes = format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT ? 16 : 8;
+    std::vector<unsigned char> output(CompressedSize(width, height, format));
+
+    auto compressRows = [&](int firstRow, int lastRow)
+    {
+        float rgb[16][3];
+        unsigned char alpha[16];
+        for (int by = firstRow; by < lastRow; ++by)
+        {
+            for (int bx = 0; bx < blocksX; ++bx)
+            {
+                unsigned char* out = &output[((size_t)by * blocksX + bx) * blockBytes];
+                bc::loadBlock(image, width, height, channels, bx, by, rgb, alpha);
+                if (blockBytes == 16)
+                {
+                    bc::encodeAlphaBlock(alpha, out);
+                    out += 8;
+                }
+                bc::encodeColorBlock(rgb, out);
+            }
+        }
+    };
+
+    if (threadCount == 0)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    threadCount = std::min(threadCount, (unsigned int)blocksY);
+
+    if (threadCount <= 1)
+    {
+        compressRows(0, blocksY);
+        return output;
+    }
+
+    std::vector<std::thread> threads;
+    int rowsPerThread = (blocksY + threadCount - 1) / threadCount;
+    for (unsigned int t = 0; t < threadCount; ++t)
+    {
+        int first = t * rowsPerThread;
+        int last = std::min(blocksY, first + rowsPerThread);
+        if (first < last)
+            threads.push_back(std::thread(compressRows, first, last));
+    }
+    for (size_t t = 0; t < threads.size(); ++t)
+        threads[t].join();
+
+    return output;
+}
+
+// Expands BC1/BC3 data back to RGBA, for measuring quality without a GPU
+inline std::vector<unsigned char> DecompressImage(const unsigned char* data, int width, int height, GLenum format)
+{
+    int blocksX = (width + 3) / 4;
+    int blocksY = (height + 3) / 4;
+    size_t blockBytes = format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT ? 16 : 8;
+    std::vector<unsigned char> image((size_t)width * height * 4);
+
+    unsigned char block[16][4];
+    for (int by = 0; by < blocksY; ++by)
+    {
+        for (int bx = 0; bx < blocksX; ++bx)
+        {
+            const unsigned char* in = data + ((size_t)by * blocksX + bx) * blockBytes;
+            if (blockBytes == 16)
+            {
+                bc::decodeColorBlock(in + 8, block);
+                bc::decodeAlphaBlock(in, block);
+            }
+            else
+            {
+                bc::decodeColorBlock(in, block);
+            }
+
+            for (int y = 0; y < 4 && by * 4 + y < height; ++y)
+                for (int x = 0; x < 4 && bx * 4 + x < width; ++x)
+                    std::memcpy(&image[(((size_t)by * 4 + y) * width + bx * 4 + x) * 4], block[y * 4 + x], 4);
+        }
+    }
+    return image;
+}
+
+// Compresses an image and its mip chain down to 1x1, BC1 when it is opaque and BC3 otherwise
+inline CompressedTexture CompressTexture(const unsigned char* image, int width, int height, int channels, unsigned int threadCount = 0, MipFilter filter = MIP_FILTER_BOX)
+{
+    CompressedTexture texture;
+    texture.Format = IsOpaque(image, width, height, channels) ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    texture.ContentHash = 0;
+
+    std::vector<MipLevel> mips = BuildMipChain(image, width, height, channels, filter, true, threadCount);
+    texture.Levels.resize(mips.size() + 1);
+    for (size_t i = 0; i < texture.Levels.size(); ++i)
+    {
+        CompressedLevel& level = texture.Levels[i];
+        level.Width = i == 0 ? width : mips[i - 1].Width;
+        level.Height = i == 0 ? height : mips[i - 1].Height;
+        level.Data = CompressImage(i == 0 ? image : mips[i - 1].Pixels.data(), level.Width, level.Height, channels, texture.Format, threadCount);
+    }
+    return texture;
+}
+
+// --bench-compress [file]: compression speed on one and all cores, and the error against the source,
+// on a synthetic gradient and optionally on an image file
+inline void BenchmarkTextureCompression(const char* file)
+{
+    int width = 2048;
+    int height = 2048;
+    int channels = 4;
+    std::vector<unsigned char> synthetic((size_t)width * height * channels);
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            unsigned char* pixel = &synthetic[((size_t)y * width + x) * channels];
+            pixel[0] = (unsigned char)(x * 255 / width);
+            pixel[1] = (unsigned char)(y * 255 / height);
+            pixel[2] = (unsigned char)((x ^ y) & 0xff);
+            pixel[3] = (unsigned char)((x + y) * 255 / (width + height));
+        }
+    }
+
+    unsigned char* image = synthetic.data();
+    unsigned char* decoded = NULL;
+    if (file)
+    {
+        decoded = stbi_load(file, &width, &height, &channels, 0);
+        if (!decoded || channels < 3)
+        {
+            std::cout << "ERROR: could not load " << file << " as RGB or RGBA" << std::endl;
+            stbi_image_free(decoded);
+            return;
+        }
+        image = decoded;
+    }
+
+    GLenum format = IsOpaque(image, width, height, channels) ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    std::cout << "Block compression, " << (file ? file : "synthetic gradient") << " " << width << "x" << height << " "
+        << (format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? "BC1" : "BC3") << ":" << std::endl;
+
+    double single = BenchmarkMilliseconds([&] { CompressImage(image, width, height, channels, format, 1); }, 3);
+    BenchmarkReport("one thread", single);
+    BenchmarkReport("all cores", BenchmarkMilliseconds([&] { CompressImage(image, width, height, channels, format); }, 3), single);
+    BenchmarkReport("all cores with mip chain", BenchmarkMilliseconds([&] { CompressTexture(image, width, height, channels); }, 3), single);
+
+    std::vector<unsigned char> compressed = CompressImage(image, width, height, channels, format);
+    std::vector<unsigned char> roundTrip = DecompressImage(compressed.data(), width, height, format);
+
+    double squaredError = 0.0;
+    for (size_t i = 0; i < (size_t)width * height; ++i)
+    {
+        for (int c = 0; c < channels; ++c)
+        {
+            double difference = (double)image[i * channels + c] - roundTrip[i * 4 + c];
+            squaredError += difference * difference;
+        }
+    }
+    double mse = squaredError / ((double)width * height * channels);
+
+    std::cout << "  " << (size_t)width * height * channels / 1024 << " KB -> " << compressed.size() / 1024 << " KB, PSNR "
+        << std::setprecision(2) << (mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : 99.0) << " dB" << std::endl;
+
+    stbi_image_free(decoded);
+}
+#endif
@@ -0,0 +1,287 @@
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include <GL/glew.h>
+
+#include <stb_image.h>
+
+#include <Hash.h>
+#include <ImageUtils.h>
+#include <MipChain.h>
+#include <TextureCache.h>
+#include <TextureCompressor.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// An image decoded on a worker thread, waiting to be uploaded into TextureId on the GL thread
+struct DecodedImage
+{
+    std::string Path;
+    GLuint TextureId;
+    int Width;
+    int Height;
+    int Channels;
+    unsigned char* Pixels;          // stb_image allocation, NULL when decoding failed or the image was compressed
+    unsigned long long ContentHash; // hash of the dimensions and flipped pixels
+    std::vector<MipLevel> Mips;     // levels below Pixels, built on the worker
+    CompressedTexture Compressed;   // block-compressed mip chain, empty Levels when Pixels holds the image
+    bool CacheHit;                  // Compressed came from the on-disk cache without decoding
+};
+
+// Decodes image files on a pool of worker threads. The GL thread queues files with Request and picks up
+// finished images with PopDecoded; only the upload itself has to run on the GL thread.
+// With Compress set, RGB and RGBA images are turned into a BC1/BC3 mip chain on the worker and kept in
+// Cache, keyed by the hash of the source file, so later runs skip decoding and compressing.
+class TextureLoader
+{
+public:
+    // let stb_image flip rows while loading instead of flipping afterwards, set before Start
+    bool FlipOnLoad;
+
+    // block-compress images through Cache, set before Start when the GL supports S3TC
+    bool Compress;
+    TextureCache Cache;
+
+    // downsampling filter for the mip chains built on the workers
+    MipFilter Filter;
+
+    // statistics, read once Pending() is 0
+    unsigned int CacheHits;
+    unsigned int CacheMisses;
+
+    TextureLoader() : FlipOnLoad(false), Compress(false), Filter(MIP_FILTER_BOX), CacheHits(0), CacheMisses(0), stopping(false), outstanding(0), workerThreads(1)
+    {
+    }
+
+    ~TextureLoader()
+    {
+        Stop();
+    }
+
+    // starts the workers, by default one per core minus the GL thread
+    void Start(unsigned int threadCount = 0)
+    {
+        if (!workers.empty())
+            return;
+
+        if (threadCount == 0)
+        {
+            unsigned int cores = std::thread::hardware_concurrency();
+            threadCount = cores > 1 ? cores - 1 : 1;
+        }
+
+        // the stb flag is global, so it is set once before any worker decodes
+        stbi_set_flip_vertically_on_load(FlipOnLoad ? 1 : 0);
+
+        // a single large texture still uses every core, several share them
+        workerThreads = std::max(1u, std::thread::hardware_concurrency() / threadCount);
+
+        stopping = false;
+        for (unsigned int i = 0; i < threadCount; ++i)
+            workers.push_back(std::thread(&TextureLoader::work, this));
+    }
+
+    // stops the workers and drops any images that were not picked up
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            jobs.clear();
+        }
+        wake.notify_all();
+
+        for (size_t i = 0; i < workers.size(); ++i)
+            workers[i].join();
+        workers.clear();
+
+        for (size_t i = 0; i < done.size(); ++i)
+            Free(done[i]);
+        done.clear();
+        outstanding = 0;
+    }
+
+    // queues path to be decoded for the texture textureId
+    void Request(const std::string& path, GLuint textureId)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            Job job;
+            job.Path = path;
+            job.TextureId = textureId;
+            jobs.push_back(job);
+            ++outstanding;
+        }
+        wake.notify_one();
+    }
+
+    // takes one finished image without blocking, returns false when none is ready
+    bool PopDecoded(DecodedImage& image)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (done.empty())
+            return false;
+
+        image = done.front();
+        done.pop_front();
+        --outstanding;
+        return true;
+    }
+
+    // images requested but not yet picked up
+    size_t Pending()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return outstanding;
+    }
+
+    static void Free(DecodedImage& image)
+    {
+        if (image.Pixels)
+            stbi_image_free(image.Pixels);
+        image.Pixels = NULL;
+        std::vector<MipLevel>().swap(image.Mips);
+        std::vector<CompressedLevel>().swap(image.Compressed.Levels);
+    }
+
+private:
+    struct Job
+    {
+        std::string Path;
+        GLuint TextureId;
+    };
+
+    std::vector<std::thread> workers;
+    std::deque<Job> jobs;
+    std::deque<DecodedImage> done;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+    size_t outstanding;
+    unsigned int workerThreads;
+
+    static bool readFile(const std::string& path, std::vector<unsigned char>& bytes)
+    {
+        FILE* file = std::fopen(path.c_str(), "rb");
+        if (!file)
+            return false;
+
+        std::fseek(file, 0, SEEK_END);
+        long size = std::ftell(file);
+        std::fseek(file, 0, SEEK_SET);
+
+        bytes.resize(size > 0 ? (size_t)size : 0);
+        bool ok = size > 0 && std::fread(bytes.data(), bytes.size(), 1, file) == 1;
+        std::fclose(file);
+        return ok;
+    }
+
+    void work()
+    {
+        for (;;)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (stopping)
+                    return;
+
+                job = jobs.front();
+                jobs.pop_front();
+            }
+
+            DecodedImage image;
+            image.Path = job.Path;
+            image.TextureId = job.TextureId;
+            image.Width = 0;
+            image.Height = 0;
+            image.Channels = 0;
+            image.ContentHash = 0;
+            image.Pixels = NULL;
+            image.Compressed.Format = 0;
+            image.Compressed.ContentHash = 0;
+            image.CacheHit = false;
+
+            if (Compress)
+            {
+                std::vector<unsigned char> bytes;
+                if (readFile(job.Path, bytes))
+                {
+                    // the same file filtered differently is a different cache entry
+                    unsigned long long sourceHash = HashBytes(bytes.data(), bytes.size());
+                    sourceHash = HashBytes(&Filter, sizeof(Filter), sourceHash);
+                    if (Cache.Load(sourceHash, image.Compressed))
+                    {
+                        image.CacheHit = true;
+                    }
+                    else
+                    {
+                        image.Pixels = stbi_load_from_memory(bytes.data(), (int)bytes.size(), &image.Width, &image.Height, &image.Channels, 0);
+                        finishDecode(image);
+
+                        if (image.Pixels && image.Channels >= 3)
+                        {
+                            image.Compressed = CompressTexture(image.Pixels, image.Width, image.Height, image.Channels, workerThreads, Filter);
+                            image.Compressed.ContentHash = image.ContentHash;
+                            Cache.Store(sourceHash, image.Compressed);
+                            stbi_image_free(image.Pixels);
+                            image.Pixels = NULL;
+                        }
+                    }
+                }
+
+                if (!image.Compressed.Levels.empty())
+                {
+                    image.Width = image.Compressed.Levels[0].Width;
+                    image.Height = image.Compressed.Levels[0].Height;
+                    image.Channels = image.Compressed.Format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? 3 : 4;
+                    image.ContentHash = image.Compressed.ContentHash;
+                }
+            }
+            else
+            {
+                image.Pixels = stbi_load(job.Path.c_str(), &image.Width, &image.Height, &image.Channels, 0);
+                finishDecode(image);
+            }
+
+            // images that were not compressed still get their mip chain built here rather than on the GPU
+            if (image.Pixels)
+                image.Mips = BuildMipChain(image.Pixels, image.Width, image.Height, image.Channels, Filter, true, workerThreads);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping)
+            {
+                Free(image);
+                return;
+            }
+            if (image.CacheHit)
+                ++CacheHits;
+            else if (!image.Compressed.Levels.empty())
+                ++CacheMisses;
+            done.push_back(image);
+        }
+    }
+
+    // flips freshly decoded pixels and hashes them for content deduplication
+    void finishDecode(DecodedImage& image)
+    {
+        if (!image.Pixels)
+            return;
+
+        if (!FlipOnLoad)
+            flipImageVertically(image.Pixels, image.Width, image.Height, image.Channels);
+
+        int dimensions[] = { image.Width, image.Height, image.Channels };
+        image.ContentHash = HashBytes(dimensions, sizeof(dimensions));
+        image.ContentHash = HashBytes(image.Pixels, (size_t)image.Width * image.Height * image.Channels, image.ContentHash);
+    }
+};
+#endif
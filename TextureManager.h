@@ -0,0 +1,131 @@
+#ifndef TEXTURE_MANAGER_H
+#define TEXTURE_MANAGER_H
+
+#include <GL/glew.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Shares GL textures between everything that loads the same image. A texture is found by its file path
+// first, and, when HashContents is on, by a hash of its decoded pixels, so two files with identical
+// contents also end up as one texture. Textures are reference counted and deleted with the last Release.
+// Pixels are decoded asynchronously, so a texture is registered under its path straight away and its
+// content hash is resolved once the decode finishes.
+class TextureManager
+{
+public:
+    bool HashContents;
+
+    // lookup statistics
+    unsigned int PathHits;
+    unsigned int ContentHits;
+    unsigned int Misses;
+
+    TextureManager() : HashContents(true), PathHits(0), ContentHits(0), Misses(0)
+    {
+    }
+
+    // returns the texture already loaded from this path, without decoding anything
+    bool FindPath(const std::string& path, GLuint& textureId)
+    {
+        std::unordered_map<std::string, GLuint>::iterator it = byPath.find(path);
+        if (it == byPath.end())
+            return false;
+
+        textureId = it->second;
+        ++entries[textureId].References;
+        ++PathHits;
+        return true;
+    }
+
+    // registers a texture that was just created for path, its content is not known yet
+    void Add(const std::string& path, GLuint textureId)
+    {
+        Entry& entry = entries[textureId];
+        entry.References = 1;
+        entry.ContentHash = 0;
+        entry.Paths.push_back(path);
+
+        byPath[path] = textureId;
+        ++Misses;
+    }
+
+    // Records the decoded content of textureId. When another texture already holds the same pixels, every
+    // reference and path of textureId moves to it, textureId is deleted and the shared texture is returned
+    // in sharedId so callers can switch over. Returns false when textureId keeps its own content.
+    bool ResolveContent(GLuint textureId, unsigned long long contentHash, GLuint& sharedId)
+    {
+        std::unordered_map<GLuint, Entry>::iterator it = entries.find(textureId);
+        if (it == entries.end() || !HashContents)
+            return false;
+
+        std::unordered_map<unsigned long long, GLuint>::iterator content = byContent.find(contentHash);
+        if (content == byContent.end() || content->second == textureId)
+        {
+            it->second.ContentHash = contentHash;
+            byContent[contentHash] = textureId;
+            return false;
+        }
+
+        sharedId = content->second;
+        Entry& shared = entries[sharedId];
+        shared.References += it->second.References;
+        for (size_t i = 0; i < it->second.Paths.size(); ++i)
+        {
+            shared.Paths.push_back(it->second.Paths[i]);
+            byPath[it->second.Paths[i]] = sharedId;
+        }
+
+        // the load turned out to be a content hit rather than a miss
+        ++ContentHits;
+        --Misses;
+
+        glDeleteTextures(1, &textureId);
+        entries.erase(it);
+        return true;
+    }
+
+    // drops one reference, the GL texture is deleted with the last one
+    void Release(GLuint textureId)
+    {
+        std::unordered_map<GLuint, Entry>::iterator it = entries.find(textureId);
+        if (it == entries.end())
+        {
+            glDeleteTextures(1, &textureId);
+            return;
+        }
+
+        if (--it->second.References > 0)
+            return;
+
+        for (size_t i = 0; i < it->second.Paths.size(); ++i)
+            byPath.erase(it->second.Paths[i]);
+
+        std::unordered_map<unsigned long long, GLuint>::iterator content = byContent.find(it->second.ContentHash);
+        if (content != byContent.end() && content->second == textureId)
+            byContent.erase(content);
+
+        glDeleteTextures(1, &textureId);
+        entries.erase(it);
+    }
+
+    // number of distinct GL textures alive
+    size_t UniqueTextures() const
+    {
+        return entries.size();
+    }
+
+private:
+    struct Entry
+    {
+        unsigned int References;
+        unsigned long long ContentHash;
+        std::vector<std::string> Paths;
+    };
+
+    std::unordered_map<GLuint, Entry> entries;
+    std::unordered_map<std::string, GLuint> byPath;
+    std::unordered_map<unsigned long long, GLuint> byContent;
+};
+#endif
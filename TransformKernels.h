@@ -0,0 +1,413 @@
+#ifndef TRANSFORM_KERNELS_H
+#define TRANSFORM_KERNELS_H
+
+#include <CpuFeatures.h>
+#include <Benchmark.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TRANSFORM_KERNELS_SIMD
+#include <immintrin.h>
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+#include <glm/simd/matrix.h>
+#endif
+#endif
+
+// Batch composition of world matrices, translate(position) * mat4_cast(rotation) * scale(scale), from arrays
+// of TRS components into an array of mat4. Instead of composing one matrix at a time the SIMD kernels work
+// on 4, 8 or 16 transforms at once: the components are transposed so each register lane holds one
+// transform, the nine rotation terms come out of a handful of multiplies, and the result is transposed
+// back into columns with glm_mat4_transpose. glm only compiles its SIMD functions with GLM_FORCE_INTRINSICS
+// or one of the GLM_FORCE_SSE* defines; without them the same shuffles come from _MM_TRANSPOSE4_PS.
+//  TRANSFORM_KERNEL_SSE41   4 transforms per iteration, SSE4.1 blends split the packed vec3s
+//  TRANSFORM_KERNEL_AVX2    8, with FMA
+//  TRANSFORM_KERNEL_AVX512  16, never picked automatically
+// Rotations must be unit quaternions stored x, y, z, w, glm's default.
+
+enum TransformKernel
+{
+    TRANSFORM_KERNEL_AUTO,      // AVX2 or the best one below it the CPU supports
+    TRANSFORM_KERNEL_SCALAR,    // reference
+    TRANSFORM_KERNEL_SSE41,
+    TRANSFORM_KERNEL_AVX2,
+    TRANSFORM_KERNEL_AVX512
+};
+
+namespace trs
+{
+    inline void composeScalar(const glm::vec3* positions, const glm::quat* rotations, const glm::vec3* scales, glm::mat4* worlds, size_t first, size_t last)
+    {
+        for (size_t i = first; i < last; ++i)
+        {
+            // the rotation's columns scaled, with the translation as the last column
+            glm::mat3 rotation = glm::mat3_cast(rotations[i]);
+            glm::mat4& world = worlds[i];
+            world[0] = glm::vec4(rotation[0] * scales[i].x, 0.0f);
+            world[1] = glm::vec4(rotation[1] * scales[i].y, 0.0f);
+            world[2] = glm::vec4(rotation[2] * scales[i].z, 0.0f);
+            world[3] = glm::vec4(positions[i], 1.0f);
+        }
+    }
+
+#ifdef TRANSFORM_KERNELS_SIMD
+    // rows of a 4x4 block become its columns
+    inline void transpose4(const __m128 in[4], __m128 out[4])
+    {
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+        glm_mat4_transpose(in, out);
+#else
+        out[0] = in[0];
+        out[1] = in[1];
+        out[2] = in[2];
+        out[3] = in[3];
+        _MM_TRANSPOSE4_PS(out[0], out[1], out[2], out[3]);
+#endif
+    }
+
+    // x, y and z of four packed vec3s, one transform per lane
+    CPU_TARGET_SSE41 inline void loadVec3x4(const glm::vec3* v, __m128& x, __m128& y, __m128& z)
+    {
+        const float* p = &v[0].x;
+        __m128 a = _mm_loadu_ps(p);         // x0 y0 z0 x1
+        __m128 b = _mm_loadu_ps(p + 4);     // y1 z1 x2 y2
+        __m128 c = _mm_loadu_ps(p + 8);     // z2 x3 y3 z3
+
+        x = _mm_blend_ps(_mm_blend_ps(a, b, 0x4), c, 0x2);     // x0 x3 x2 x1
+        y = _mm_blend_ps(_mm_blend_ps(a, b, 0x9), c, 0x4);     // y1 y0 y3 y2
+        z = _mm_blend_ps(_mm_blend_ps(a, b, 0x2), c, 0x9);     // z2 z1 z0 z3
+        x = _mm_shuffle_ps(x, x, _MM_SHUFFLE(1, 2, 3, 0));
+        y = _mm_shuffle_ps(y, y, _MM_SHUFFLE(2, 3, 0, 1));
+        z = _mm_shuffle_ps(z, z, _MM_SHUFFLE(3, 0, 1, 2));
+    }
+
+    // x, y, z and w of four quaternions
+    inline void loadQuatx4(const glm::quat* q, __m128& x, __m128& y, __m128& z, __m128& w)
+    {
+        const float* p = &q[0].x;
+        __m128 in[4] = { _mm_loadu_ps(p), _mm_loadu_ps(p + 4), _mm_loadu_ps(p + 8), _mm_loadu_ps(p + 12) };
+        __m128 out[4];
+        transpose4(in, out);
+        x = out[0];
+        y = out[1];
+        z = out[2];
+        w = out[3];
+    }
+
+    // column of four matrices from its x, y, z, w across transforms, written to worlds[0..3][column]
+    inline void storeColumnx4(glm::mat4* worlds, int column, __m128 x, __m128 y, __m128 z, __m128 w)
+    {
+        __m128 in[4] = { x, y, z, w };
+        __m128 out[4];
+        transpose4(in, out);
+        for (int k = 0; k < 4; ++k)
+            _mm_storeu_ps(&worlds[k][column].x, out[k]);
+    }
+
+    CPU_TARGET_SSE41 inline void composeSse41(const glm::vec3* positions, const glm::quat* rotations, const glm::vec3* scales, glm::mat4* worlds, size_t first, size_t last)
+    {
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 two = _mm_set1_ps(2.0f);
+        const __m128 zero = _mm_setzero_ps();
+
+        size_t i = first;
+        for (; i + 4 <= last; i += 4)
+        {
+            __m128 qx, qy, qz, qw, px, py, pz, sx, sy, sz;
+            loadQuatx4(rotations + i, qx, qy, qz, qw);
+            loadVec3x4(positions + i, px, py, pz);
+            loadVec3x4(scales + i, sx, sy, sz);
+
+            // doubled components save a multiply per product below
+            __m128 x2 = _mm_mul_ps(qx, two), y2 = _mm_mul_ps(qy, two), z2 = _mm_mul_ps(qz, two);
+            __m128 xx = _mm_mul_ps(qx, x2), yy = _mm_mul_ps(qy, y2), zz = _mm_mul_ps(qz, z2);
+            __m128 xy = _mm_mul_ps(qx, y2), xz = _mm_mul_ps(qx, z2), yz = _mm_mul_ps(qy, z2);
+            __m128 wx = _mm_mul_ps(qw, x2), wy = _mm_mul_ps(qw, y2), wz = _mm_mul_ps(qw, z2);
+
+            storeColumnx4(worlds + i, 0, _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(yy, zz)), sx), _mm_mul_ps(_mm_add_ps(xy, wz), sx), _mm_mul_ps(_mm_sub_ps(xz, wy), sx), zero);
+            storeColumnx4(worlds + i, 1, _mm_mul_ps(_mm_sub_ps(xy, wz), sy), _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, zz)), sy), _mm_mul_ps(_mm_add_ps(yz, wx), sy), zero);
+            storeColumnx4(worlds + i, 2, _mm_mul_ps(_mm_add_ps(xz, wy), sz), _mm_mul_ps(_mm_sub_ps(yz, wx), sz), _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, yy)), sz), zero);
+            storeColumnx4(worlds + i, 3, px, py, pz, one);
+        }
+        composeScalar(positions, rotations, scales, worlds, i, last);
+    }
+
+    // The wide kernels keep each group of four transforms in its own 128 bit lane: the shuffles, unpacks and
+    // blends of AVX and AVX-512 work lane by lane, so one instruction transposes two or four 4x4 blocks.
+
+    // four floats from each address, one per 128 bit lane
+    CPU_TARGET_AVX2 inline __m256 load2(const float* low, const float* high)
+    {
+        return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(low)), _mm_loadu_ps(high), 1);
+    }
+
+    CPU_TARGET_AVX2 inline void transpose8(__m256& r0, __m256& r1, __m256& r2, __m256& r3)
+    {
+        __m256 t0 = _mm256_shuffle_ps(r0, r1, 0x44);
+        __m256 t2 = _mm256_shuffle_ps(r0, r1, 0xEE);
+        __m256 t1 = _mm256_shuffle_ps(r2, r3, 0x44);
+        __m256 t3 = _mm256_shuffle_ps(r2, r3, 0xEE);
+        r0 = _mm256_shuffle_ps(t0, t1, 0x88);
+        r1 = _mm256_shuffle_ps(t0, t1, 0xDD);
+        r2 = _mm256_shuffle_ps(t2, t3, 0x88);
+        r3 = _mm256_shuffle_ps(t2, t3, 0xDD);
+    }
+
+    // loadVec3x4 on transforms 0-3 and 4-7
+    CPU_TARGET_AVX2 inline void loadVec3x8(const glm::vec3* v, __m256& x, __m256& y, __m256& z)
+    {
+        const float* p = &v[0].x;
+        __m256 a = load2(p, p + 12);
+        __m256 b = load2(p + 4, p + 16);
+        __m256 c = load2(p + 8, p + 20);
+
+        x = _mm256_blend_ps(_mm256_blend_ps(a, b, 0x44), c, 0x22);
+        y = _mm256_blend_ps(_mm256_blend_ps(a, b, 0x99), c, 0x44);
+        z = _mm256_blend_ps(_mm256_blend_ps(a, b, 0x22), c, 0x99);
+        x = _mm256_shuffle_ps(x, x, _MM_SHUFFLE(1, 2, 3, 0));
+        y = _mm256_shuffle_ps(y, y, _MM_SHUFFLE(2, 3, 0, 1));
+        z = _mm256_shuffle_ps(z, z, _MM_SHUFFLE(3, 0, 1, 2));
+    }
+
+    CPU_TARGET_AVX2 inline void loadQuatx8(const glm::quat* q, __m256& x, __m256& y, __m256& z, __m256& w)
+    {
+        const float* p = &q[0].x;
+        x = load2(p, p + 16);
+        y = load2(p + 4, p + 20);
+        z = load2(p + 8, p + 24);
+        w = load2(p + 12, p + 28);
+        transpose8(x, y, z, w);
+    }
+
+    CPU_TARGET_AVX2 inline void storeColumnx8(glm::mat4* worlds, int column, __m256 x, __m256 y, __m256 z, __m256 w)
+    {
+        transpose8(x, y, z, w);
+        __m256 rows[4] = { x, y, z, w };
+        for (int k = 0; k < 4; ++k)
+        {
+            _mm_storeu_ps(&worlds[k][column].x, _mm256_castps256_ps128(rows[k]));
+            _mm_storeu_ps(&worlds[k + 4][column].x, _mm256_extractf128_ps(rows[k], 1));
+        }
+    }
+
+    CPU_TARGET_AVX2 inline void composeAvx2(const glm::vec3* positions, const glm::quat* rotations, const glm::vec3* scales, glm::mat4* worlds, size_t first, size_t last)
+    {
+        const __m256 one = _mm256_set1_ps(1.0f);
+        const __m256 two = _mm256_set1_ps(2.0f);
+        const __m256 zero = _mm256_setzero_ps();
+
+        size_t i = first;
+        for (; i + 8 <= last; i += 8)
+        {
+            __m256 qx, qy, qz, qw, px, py, pz, sx, sy, sz;
+            loadQuatx8(rotations + i, qx, qy, qz, qw);
+            loadVec3x8(positions + i, px, py, pz);
+            loadVec3x8(scales + i, sx, sy, sz);
+
+            __m256 x2 = _mm256_mul_ps(qx, two), y2 = _mm256_mul_ps(qy, two), z2 = _mm256_mul_ps(qz, two);
+            __m256 xx = _mm256_mul_ps(qx, x2), yy = _mm256_mul_ps(qy, y2), zz = _mm256_mul_ps(qz, z2);
+            __m256 xy = _mm256_mul_ps(qx, y2), xz = _mm256_mul_ps(qx, z2), yz = _mm256_mul_ps(qy, z2);
+            __m256 wx = _mm256_mul_ps(qw, x2), wy = _mm256_mul_ps(qw, y2), wz = _mm256_mul_ps(qw, z2);
+
+            // s - (a + b) * s fuses the diagonal's 1 - (a + b) with its scale
+            storeColumnx8(worlds + i, 0, _mm256_fnmadd_ps(_mm256_add_ps(yy, zz), sx, sx), _mm256_mul_ps(_mm256_add_ps(xy, wz), sx), _mm256_mul_ps(_mm256_sub_ps(xz, wy), sx), zero);
+            storeColumnx8(worlds + i, 1, _mm256_mul_ps(_mm256_sub_ps(xy, wz), sy), _mm256_fnmadd_ps(_mm256_add_ps(xx, zz), sy, sy), _mm256_mul_ps(_mm256_add_ps(yz, wx), sy), zero);
+            storeColumnx8(worlds + i, 2, _mm256_mul_ps(_mm256_add_ps(xz, wy), sz), _mm256_mul_ps(_mm256_sub_ps(yz, wx), sz), _mm256_fnmadd_ps(_mm256_add_ps(xx, yy), sz, sz), zero);
+            storeColumnx8(worlds + i, 3, px, py, pz, one);
+        }
+        composeSse41(positions, rotations, scales, worlds, i, last);
+    }
+
+    // four floats from p, p + stride, p + 2 * stride and p + 3 * stride, one per 128 bit lane
+    CPU_TARGET_AVX512 inline __m512 load4(const float* p, size_t stride)
+    {
+        __m512 result = _mm512_castps128_ps512(_mm_loadu_ps(p));
+        result = _mm512_insertf32x4(result, _mm_loadu_ps(p + stride), 1);
+        result = _mm512_insertf32x4(result, _mm_loadu_ps(p + 2 * stride), 2);
+        return _mm512_insertf32x4(result, _mm_loadu_ps(p + 3 * stride), 3);
+    }
+
+    CPU_TARGET_AVX512 inline void transpose16(__m512& r0, __m512& r1, __m512& r2, __m512& r3)
+    {
+        __m512 t0 = _mm512_shuffle_ps(r0, r1, 0x44);
+        __m512 t2 = _mm512_shuffle_ps(r0, r1, 0xEE);
+        __m512 t1 = _mm512_shuffle_ps(r2, r3, 0x44);
+        __m512 t3 = _mm512_shuffle_ps(r2, r3, 0xEE);
+        r0 = _mm512_shuffle_ps(t0, t1, 0x88);
+        r1 = _mm512_shuffle_ps(t0, t1, 0xDD);
+        r2 = _mm512_shuffle_ps(t2, t3, 0x88);
+        r3 = _mm512_shuffle_ps(t2, t3, 0xDD);
+    }
+
+    CPU_TARGET_AVX512 inline void loadVec3x16(const glm::vec3* v, __m512& x, __m512& y, __m512& z)
+    {
+        const float* p = &v[0].x;
+        __m512 a = load4(p, 12);
+        __m512 b = load4(p + 4, 12);
+        __m512 c = load4(p + 8, 12);
+
+        x = _mm512_mask_blend_ps(0x2222, _mm512_mask_blend_ps(0x4444, a, b), c);
+        y = _mm512_mask_blend_ps(0x4444, _mm512_mask_blend_ps(0x9999, a, b), c);
+        z = _mm512_mask_blend_ps(0x9999, _mm512_mask_blend_ps(0x2222, a, b), c);
+        x = _mm512_shuffle_ps(x, x, _MM_SHUFFLE(1, 2, 3, 0));
+        y = _mm512_shuffle_ps(y, y, _MM_SHUFFLE(2, 3, 0, 1));
+        z = _mm512_shuffle_ps(z, z, _MM_SHUFFLE(3, 0, 1, 2));
+    }
+
+    CPU_TARGET_AVX512 inline void loadQuatx16(const glm::quat* q, __m512& x, __m512& y, __m512& z, __m512& w)
+    {
+        const float* p = &q[0].x;
+        x = load4(p, 16);
+        y = load4(p + 4, 16);
+        z = load4(p + 8, 16);
+        w = load4(p + 12, 16);
+        transpose16(x, y, z, w);
+    }
+
+    CPU_TARGET_AVX512 inline void storeColumnx16(glm::mat4* worlds, int column, __m512 x, __m512 y, __m512 z, __m512 w)
+    {
+        transpose16(x, y, z, w);
+        __m512 rows[4] = { x, y, z, w };
+        for (int k = 0; k < 4; ++k)
+        {
+            _mm_storeu_ps(&worlds[k][column].x, _mm512_extractf32x4_ps(rows[k], 0));
+            _mm_storeu_ps(&worlds[k + 4][column].x, _mm512_extractf32x4_ps(rows[k], 1));
+            _mm_storeu_ps(&worlds[k + 8][column].x, _mm512_extractf32x4_ps(rows[k], 2));
+            _mm_storeu_ps(&worlds[k + 12][column].x, _mm512_extractf32x4_ps(rows[k], 3));
+        }
+    }
+
+    CPU_TARGET_AVX512 inline void composeAvx512(const glm::vec3* positions, const glm::quat* rotations, const glm::vec3* scales, glm::mat4* worlds, size_t first, size_t last)
+    {
+        const __m512 one = _mm512_set1_ps(1.0f);
+        const __m512 two = _mm512_set1_ps(2.0f);
+        const __m512 zero = _mm512_setzero_ps();
+
+        size_t i = first;
+        for (; i + 16 <= last; i += 16)
+        {
+            __m512 qx, qy, qz, qw, px, py, pz, sx, sy, sz;
+            loadQuatx16(rotations + i, qx, qy, qz, qw);
+            loadVec3x16(positions + i, px, py, pz);
+            loadVec3x16(scales + i, sx, sy, sz);
+
+            __m512 x2 = _mm512_mul_ps(qx, two), y2 = _mm512_mul_ps(qy, two), z2 = _mm512_mul_ps(qz, two);
+            __m512 xx = _mm512_mul_ps(qx, x2), yy = _mm512_mul_ps(qy, y2), zz = _mm512_mul_ps(qz, z2);
+            __m512 xy = _mm512_mul_ps(qx, y2), xz = _mm512_mul_ps(qx, z2), yz = _mm512_mul_ps(qy, z2);
+            __m512 wx = _mm512_mul_ps(qw, x2), wy = _mm512_mul_ps(qw, y2), wz = _mm512_mul_ps(qw, z2);
+
+            storeColumnx16(worlds + i, 0, _mm512_fnmadd_ps(_mm512_add_ps(yy, zz), sx, sx), _mm512_mul_ps(_mm512_add_ps(xy, wz), sx), _mm512_mul_ps(_mm512_sub_ps(xz, wy), sx), zero);
+            storeColumnx16(worlds + i, 1, _mm512_mul_ps(_mm512_sub_ps(xy, wz), sy), _mm512_fnmadd_ps(_mm512_add_ps(xx, zz), sy, sy), _mm512_mul_ps(_mm512_add_ps(yz, wx), sy), zero);
+            storeColumnx16(worlds + i, 2, _mm512_mul_ps(_mm512_add_ps(xz, wy), sz), _mm512_mul_ps(_mm512_sub_ps(yz, wx), sz), _mm512_fnmadd_ps(_mm512_add_ps(xx, yy), sz, sz), zero);
+            storeColumnx16(worlds + i, 3, px, py, pz, one);
+        }
+        composeAvx2(positions, rotations, scales, worlds, i, last);
+    }
+#endif
+
+    inline TransformKernel resolveKernel(TransformKernel kernel)
+    {
+#ifdef TRANSFORM_KERNELS_SIMD
+        const CpuFeatures& cpu = GetCpuFeatures();
+        // the work is bound by the 64 byte stores per matrix, and 16 lanes measured no faster than 8 while
+        // costing clock speed on some CPUs, so AVX-512 is only used when asked for
+        if (kernel == TRANSFORM_KERNEL_AUTO)
+            kernel = TRANSFORM_KERNEL_AVX2;
+        if (kernel == TRANSFORM_KERNEL_AVX512 && !cpu.Avx512f)
+            kernel = TRANSFORM_KERNEL_AVX2;
+        if (kernel == TRANSFORM_KERNEL_AVX2 && !(cpu.Avx2 && cpu.Fma))
+            kernel = TRANSFORM_KERNEL_SSE41;
+        if (kernel == TRANSFORM_KERNEL_SSE41 && !cpu.Sse41)
+            kernel = TRANSFORM_KERNEL_SCALAR;
+        return kernel;
+#else
+        (void)kernel;
+        return TRANSFORM_KERNEL_SCALAR;
+#endif
+    }
+}
+
+// Writes worlds[i] for i in [first, last) with the given kernel, or the one AUTO resolves to
+inline void ComposeTransforms(const glm::vec3* positions, const glm::quat* rotations, const glm::vec3* scales, glm::mat4* worlds,
+    size_t first, size_t last, TransformKernel kernel = TRANSFORM_KERNEL_AUTO)
+{
+    // resolved once, the dispatch runs for every slice of every frame
+    static const TransformKernel best = trs::resolveKernel(TRANSFORM_KERNEL_AUTO);
+    kernel = kernel == TRANSFORM_KERNEL_AUTO ? best : trs::resolveKernel(kernel);
+
+#ifdef TRANSFORM_KERNELS_SIMD
+    if (kernel == TRANSFORM_KERNEL_AVX512)
+        return trs::composeAvx512(positions, rotations, scales, worlds, first, last);
+    if (kernel == TRANSFORM_KERNEL_AVX2)
+        return trs::composeAvx2(positions, rotations, scales, worlds, first, last);
+    if (kernel == TRANSFORM_KERNEL_SSE41)
+        return trs::composeSse41(positions, rotations, scales, worlds, first, last);
+#endif
+    trs::composeScalar(positions, rotations, scales, worlds, first, last);
+}
+
+// --bench-trs: every kernel against composing glm::translate * glm::mat4_cast * glm::scale one object at a
+// time, for a range of batch sizes, checking each kernel against the glm result
+inline void BenchmarkTransformKernels()
+{
+    const size_t sizes[] = { 1000, 100000, 1000000 };
+    const size_t largest = 1000000;
+
+    std::vector<glm::vec3> positions(largest), scales(largest);
+    std::vector<glm::quat> rotations(largest);
+    for (size_t i = 0; i < largest; ++i)
+    {
+        float f = (float)i;
+        positions[i] = glm::vec3(f * 0.01f, std::sin(f), -f * 0.02f);
+        rotations[i] = glm::angleAxis(f * 0.001f, glm::normalize(glm::vec3(std::sin(f), 1.0f, std::cos(f))));
+        scales[i] = glm::vec3(1.0f + (i % 7) * 0.1f, 0.5f, 2.0f - (i % 3) * 0.25f);
+    }
+    std::vector<glm::mat4> reference(largest), worlds(largest);
+
+    const TransformKernel kernels[] = { TRANSFORM_KERNEL_SCALAR, TRANSFORM_KERNEL_SSE41, TRANSFORM_KERNEL_AVX2, TRANSFORM_KERNEL_AVX512 };
+    const char* kernelNames[] = { "scalar", "SSE4.1", "AVX2", "AVX-512" };
+
+    for (size_t n = 0; n < sizeof(sizes) / sizeof(sizes[0]); ++n)
+    {
+        size_t count = sizes[n];
+        std::cout << "World matrices from TRS, " << count << " transforms:" << std::endl;
+
+        double glmLoop = BenchmarkMilliseconds([&] {
+            for (size_t i = 0; i < count; ++i)
+                reference[i] = glm::translate(glm::mat4(1.0f), positions[i]) * glm::mat4_cast(rotations[i]) * glm::scale(glm::mat4(1.0f), scales[i]);
+        });
+        BenchmarkReport("glm translate * rotate * scale", glmLoop);
+
+        for (int k = 0; k < 4; ++k)
+        {
+            if (trs::resolveKernel(kernels[k]) != kernels[k])
+                continue;
+
+            ComposeTransforms(positions.data(), rotations.data(), scales.data(), worlds.data(), 0, count, kernels[k]);
+            float worst = 0.0f;
+            for (size_t i = 0; i < count; ++i)
+            {
+                for (int c = 0; c < 4; ++c)
+                {
+                    glm::vec4 difference = glm::abs(reference[i][c] - worlds[i][c]);
+                    worst = glm::max(worst, glm::max(glm::max(difference.x, difference.y), glm::max(difference.z, difference.w)));
+                }
+            }
+            if (worst > 1e-4f)
+                std::cout << "ERROR: " << kernelNames[k] << " differs from glm by " << worst << std::endl;
+
+            double ms = BenchmarkMilliseconds([&] { ComposeTransforms(positions.data(), rotations.data(), scales.data(), worlds.data(), 0, count, kernels[k]); });
+            BenchmarkReport(kernelNames[k], ms, glmLoop);
+        }
+        std::cout << "  " << count / (BenchmarkMilliseconds([&] { ComposeTransforms(positions.data(), rotations.data(), scales.data(), worlds.data(), 0, count); }) * 1000.0)
+            << " M transforms/s with the dispatched kernel" << std::endl;
+    }
+}
+#endif
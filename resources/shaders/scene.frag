@@ -0,0 +1,61 @@
+#version 440 core
+
+// Feature defines are inserted after the #version line by the shader permutations:
+// BINDLESS samples through a table of resident texture handles instead of the atlas,
+// ALPHA_TEST discards texels below half coverage, LIGHTING shades the faces with one directional light.
+
+#ifdef BINDLESS
+#extension GL_ARB_bindless_texture : require
+#endif
+
+in vec2 vertexTextureCoordinate; // Variable to hold incoming color data from vertex shader
+flat in float vertexLayer; // atlas layer, or index into the handle table
+#ifdef LIGHTING
+in vec3 vertexPosition;
+#endif
+
+out vec4 fragmentColor;
+
+#ifdef BINDLESS
+// Resident texture handles, two 32 bit halves each
+layout(std430, binding = 1) readonly buffer TextureHandles
+{
+    uvec2 handles[];
+};
+#else
+uniform sampler2DArray uTexture;
+#endif
+
+#ifdef LIGHTING
+const vec3 lightDirection = vec3(0.36f, 0.80f, 0.48f); // normalized, towards the light
+const float ambient = 0.3f;
+#endif
+
+void main()
+{
+    // textures that are still loading, or failed to, are not in the atlas yet and show grey
+    if (vertexLayer < 0.0)
+    {
+        fragmentColor = vec4(0.5f, 0.5f, 0.5f, 1.0f);
+        return;
+    }
+
+#ifdef BINDLESS
+    vec4 color = texture(sampler2D(handles[int(vertexLayer)]), vertexTextureCoordinate);
+#else
+    vec4 color = texture(uTexture, vec3(vertexTextureCoordinate, vertexLayer));
+#endif
+
+#ifdef ALPHA_TEST
+    if (color.a < 0.5f)
+        discard;
+#endif
+
+#ifdef LIGHTING
+    // the meshes carry no normals, the face normal follows from how the position changes across the pixel
+    vec3 normal = normalize(cross(dFdx(vertexPosition), dFdy(vertexPosition)));
+    color.rgb *= ambient + (1.0f - ambient) * max(dot(normal, lightDirection), 0.0f);
+#endif
+
+    fragmentColor = color;
+}
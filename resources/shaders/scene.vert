@@ -0,0 +1,88 @@
+#version 440 core
+
+// Feature defines are inserted after the #version line by the shader permutations:
+// INSTANCING reads the model matrix and texture region from per-instance attributes instead of the ObjectData block,
+// MULTI_DRAW reads them from the DrawData of the draw, found by gl_DrawIDARB with DRAW_PARAMETERS and by
+// the draw index attribute without, LIGHTING passes the world position on so the fragment shader can shade the faces.
+
+#if defined(MULTI_DRAW) && defined(DRAW_PARAMETERS)
+#extension GL_ARB_shader_draw_parameters : require
+#endif
+
+layout(location = 0) in vec3 position; // Vertex data from Vertex Attrib Pointer 0
+layout(location = 1) in vec2 textureCoordinate;  // Texture data from Vertex Attrib Pointer 1
+#if defined(MULTI_DRAW)
+// One entry per draw of the multi-draw
+struct DrawData
+{
+    mat4 model;
+    vec4 uvTransform;
+    vec4 layer; // in x
+};
+
+layout(std430, binding = 2) readonly buffer DrawDataBuffer
+{
+    DrawData draws[];
+};
+#ifndef DRAW_PARAMETERS
+layout(location = 8) in uint drawIndex; // every draw starts at its own index as base instance
+#endif
+#elif defined(INSTANCING)
+layout(location = 2) in mat4 instanceModel;  // Per-instance model matrix, uses locations 2 to 5
+layout(location = 6) in float instanceLayer;  // Per-instance texture layer
+layout(location = 7) in vec4 instanceUVTransform;  // Per-instance atlas region, scale in xy and offset in zw
+#else
+// The object transform and its region of the texture atlas, a range of the render queue's per-draw data
+layout(std140, binding = 3) uniform ObjectData
+{
+    mat4 model;
+    vec4 uvTransform;
+    vec4 layer; // in x
+};
+#endif
+
+out vec2 vertexTextureCoordinate; // variable to transfer color data to the fragment shader
+flat out float vertexLayer;
+#ifdef LIGHTING
+out vec3 vertexPosition; // world space
+#endif
+
+// Camera matrices, written once per frame and shared by every program
+layout(std140, binding = 0) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec4 cameraPosition;
+    float time;
+};
+
+void main()
+{
+#if defined(MULTI_DRAW)
+#ifdef DRAW_PARAMETERS
+    DrawData draw = draws[gl_DrawIDARB];
+#else
+    DrawData draw = draws[drawIndex];
+#endif
+    mat4 objectModel = draw.model;
+    float objectLayer = draw.layer.x;
+    vec4 objectUVTransform = draw.uvTransform;
+#elif defined(INSTANCING)
+    mat4 objectModel = instanceModel;
+    float objectLayer = instanceLayer;
+    vec4 objectUVTransform = instanceUVTransform;
+#else
+    mat4 objectModel = model;
+    float objectLayer = layer.x;
+    vec4 objectUVTransform = uvTransform;
+#endif
+
+    vec4 worldPosition = objectModel * vec4(position, 1.0f);
+    gl_Position = viewProjection * worldPosition; // transforms vertices to clip coordinates
+    vertexTextureCoordinate = textureCoordinate * objectUVTransform.xy + objectUVTransform.zw; // references incoming color data
+    vertexLayer = objectLayer;
+#ifdef LIGHTING
+    vertexPosition = worldPosition.xyz;
+#endif
+}